@@ -0,0 +1,134 @@
+/* PS2_TVI.h, pin assignments, key codes and TVI bits for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PS2_TVI_H
+#define PS2_TVI_H
+
+#define PS2DATA_PIN 4
+#define PS2CLOCK_PIN 3
+#define RSTOUT_PIN 2
+#define LED_PIN 13
+#define PASTE_RX_PIN 8		// Text to paste, from the PC, see paste.h
+#define PASTE_TX_PIN 9
+#define PASTE_CTS_PIN 10	// Low when the PC may send
+#ifndef CHANNELS
+#define CHANNELS 1		// Keyboard and terminal pairs, see converter.h
+#endif
+// The pairs after the first, on a Mega.  The clocks share port K's pin
+// change interrupt, see ps2rx.cpp
+#define CH_DATA_PINS	{ 22, 24, 26 }
+#define CH_CLOCK_PINS	{ 62, 63, 64 }	// A8 - A10
+#define CH_RSTOUT_PINS	{ 23, 25, 27 }
+#define CH_SERIALS	{ &Serial1, &Serial2, &Serial3 }
+#ifndef HOSTBAUD
+#define HOSTBAUD (9600)
+#endif
+
+#define MOD_LSHIFT 1
+#define MOD_RSHIFT 2
+#define MOD_LCTRL  4
+#define MOD_RCTRL  8
+#define MOD_LALT   16
+#define MOD_RALT   32
+#define MOD_CLOCK  64
+#define MOD_NLOCK  128
+
+#define TVI_ALOCK (0x10)
+#define TVI_SHIFT (0x20)
+#define TVI_CTRL  (0x40)
+#define TVI_FUNCT (0x80)
+
+#define KEY_F1	(0x80)
+#define KEY_F2	(0x81)
+#define KEY_F3	(0x82)
+#define KEY_F4	(0x83)
+#define KEY_F5	(0x84)
+#define KEY_F6	(0x85)
+#define KEY_F7	(0x86)
+#define KEY_F8	(0x87)
+#define KEY_F9	(0x88)
+#define KEY_F10	(0x89)
+#define KEY_F11	(0x8A)
+#define KEY_F12	(0x8B)
+#define KEY_F13	(0x8C)
+#define KEY_F14	(0x8D)
+#define KEY_F15	(0x8E)
+#define KEY_F16	(0x8F)
+#define KEY_KP_0	(0x90)
+#define KEY_KP_1	(0x91)
+#define KEY_KP_2	(0x92)
+#define KEY_KP_3	(0x93)
+#define KEY_KP_4	(0x94)
+#define KEY_KP_5	(0x95)
+#define KEY_KP_6	(0x96)
+#define KEY_KP_7	(0x97)
+#define KEY_KP_8	(0x98)
+#define KEY_KP_9	(0x99)
+#define KEY_KP_DOT	(0x9A)
+#define KEY_KP_PLUS	(0x9B)
+#define KEY_KP_DASH	(0x9C)
+#define KEY_KP_STAR	(0x9D)
+#define KEY_KP_SLASH	(0x9E)
+#define KEY_KP_ENTER	(0x9F)
+#define KEY_SLOCK	(0xA0)
+#define KEY_BREAK	(0xA1)
+#define KEY_PRTSC	(0xA2)
+#define KEY_PAUSE	(0xA3)
+#define KEY_SYSRQ	(0xA4)
+#define KEY_ENTER	(0xA8)
+#define KEY_BKSP	(0xA9)
+#define KEY_TAB		(0xAA)
+#define KEY_ESC		(0xAB)
+#define KEY_E0_INS	(0xB0)
+#define KEY_E0_END	(0xB1)
+#define KEY_E0_DOWN	(0xB2)
+#define KEY_E0_PGDN	(0xB3)
+#define KEY_E0_LEFT	(0xB4)
+#define KEY_E0_RIGHT	(0xB6)
+#define KEY_E0_HOME	(0xB7)
+#define KEY_E0_UP	(0xB8)
+#define KEY_E0_PGUP	(0xB9)
+#define KEY_E0_DEL	(0xBA)
+#define SHIFT_OFFSET	(0x40)
+#define NLOCK_OFFSET	(KEY_E0_INS-KEY_KP_0)
+
+#define SCAN_LSHIFT	(0x12)
+#define SCAN_RSHIFT	(0x59)
+#define SCAN_ALT	(0x11)
+#define SCAN_CTRL	(0x14)
+#define SCAN_NLOCK	(0x77)
+#define SCAN_CLOCK	(0x58)
+#define SCAN_SYSRQ	(0x84)
+
+#define SCAN_E0_END	(0x69)
+#define SCAN_E0_LEFT	(0x6B)
+#define SCAN_E0_HOME 	(0x6C)
+#define SCAN_E0_INS 	(0x70)
+#define SCAN_E0_DEL 	(0x71)
+#define SCAN_E0_DOWN 	(0x72)
+#define SCAN_E0_RIGHT 	(0x74)
+#define SCAN_E0_UP 	(0x75)
+#define SCAN_E0_PGDN 	(0x7A)
+#define SCAN_E0_PGUP 	(0x7D)
+#define SCAN_E0_KPSL 	(0x4A)
+#define SCAN_E0_KPENT 	(0x5A)
+#define SCAN_E0_PRTSC	(0x7C)
+#define SCAN_E0_BREAK	(0x7E)
+
+#endif
@@ -1,3 +1 @@
-#include <PS2Keyboard.h>
-
-
+// setup() and loop() are in PS2_TVI.cpp
@@ -0,0 +1,56 @@
+/* boot.cpp, bringing the keyboard up at power on
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// See boot.h
+
+#include "boot.h"
+#include "ps2cmd.h"
+
+byte boot_result;
+unsigned int boot_ms;
+
+static unsigned long resetAt;		// millis() when the reset was queued
+
+// Reset the keyboard, and don't wait for it
+void boot_begin(void) {
+	boot_result = BOOT_WAITING;
+	boot_ms = 0;
+	resetAt = millis();
+	ps2cmd_send(PS2_CMD_RESET);
+	ps2cmd_poll();			// Start pulling the clock low now
+}
+
+// The keyboard's answer to the reset, or to being plugged in
+void boot_selfTest(bool passed) {
+	if (boot_result == BOOT_WAITING)
+		boot_result = passed ? BOOT_PASS : BOOT_FAIL;
+}
+
+// Called from loop()
+void boot_poll(void) {
+	if (boot_ms)
+		return;
+	if (boot_result == BOOT_WAITING) {
+		if (millis() - resetAt < BOOT_BAT_MS)
+			return;
+		boot_result = BOOT_TIMEOUT;
+	}
+	if (ps2cmd_idle())
+		boot_ms = millis();
+}
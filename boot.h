@@ -0,0 +1,57 @@
+/* boot.h, bringing the keyboard up at power on
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// setup() used to reset the keyboard with a blocking sendByte(), which never
+// returned with no keyboard plugged in, and then send the LEDs into the
+// middle of its self test, where they were NAKed or timed out.  Now
+// boot_begin() only queues the reset with ps2cmd.cpp and gets it onto the
+// wire, and setup() carries on bringing up the UARTs while the keyboard
+// tests itself, which takes 300 - 750ms.
+//
+// The self test ends with PS2_BAT_OK, or PS2_BAT_FAIL.  Either way
+// converter.cpp sets the keyboard up again (its LEDs, and its scan code set
+// and typematic, see scanset.h) and tells boot_selfTest().  If neither has
+// come in BOOT_BAT_MS we give up waiting, and a keyboard plugged in later is
+// set up when its own BAT_OK arrives, as always.
+//
+// The converter is ready once that's decided and the commands it queued have
+// gone out; boot_ms is millis() at that point, the boot to ready time.  Both
+// are in the stats reply, STAT_BOOT and STAT_BOOTMS.
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include "hal.h"
+
+#define BOOT_BAT_MS	1000		// Longest we wait for the self test
+
+// boot_result
+#define BOOT_WAITING	0
+#define BOOT_PASS	1
+#define BOOT_FAIL	2
+#define BOOT_TIMEOUT	3		// Nothing heard, no keyboard maybe
+
+extern byte boot_result;
+extern unsigned int boot_ms;		// 0 until ready
+
+void boot_begin(void);
+void boot_selfTest(bool passed);
+void boot_poll(void);
+
+#endif
@@ -0,0 +1,233 @@
+/* converter.cpp, one keyboard and terminal pair
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Scan codes go through the converter's Decoder to a key, the key and the
+// modifiers held with it through xlat_frame() to a TVI frame, and the frame into
+// the converter's own queue.  See converter.h.
+
+#include "converter.h"
+#include "ps2cmd.h"
+#include "tvi_xlat.h"
+#include "trace.h"
+#include "stats.h"
+#include "scanset.h"
+#include "macro.h"
+#include "ps2rx.h"
+#include "boot.h"
+
+// Send the keyboard LEDs; this only queues the command, see ps2cmd.cpp
+static void sendLEDs(byte mod) {
+	byte leds=0;
+
+	if (mod & MOD_CLOCK)
+		leds = 4;
+	if (mod & MOD_NLOCK)
+		leds |= 2;
+
+	ps2cmd_setLEDs(leds);
+}
+
+#define RESET_TICKS	((RESET_MS) * 1000L / HAL_TICK_US)
+
+static volatile byte resets;		// Converters holding their reset line
+
+// Timer tick: end the reset pulses that are due, and the LED with the last
+static void resetTick(void) {
+	byte i;
+
+	for (i=0; i<CHANNELS; i++) {
+		Converter &c = converters[i];
+
+		if (c.resetting && !--c.resetLeft) {
+			digitalWrite(c.rstPin, HIGH);
+			c.resetting = false;
+			if (!--resets)
+				digitalWrite(LED_PIN, LOW);
+		}
+	}
+}
+
+// Sys-Rq = reset system
+static void resetStart(Converter &c) {
+	if (c.resetting)
+		return;
+	digitalWrite(c.rstPin, LOW);
+	digitalWrite(LED_PIN, HIGH);
+	c.resetLeft = RESET_TICKS;
+	noInterrupts();
+	resets++;
+	c.resetting = true;
+	interrupts();
+	if (RESET_POLICY != TVIQ_OPEN)
+		tviq_hold(c.txq, RESET_POLICY);
+}
+
+bool converter_resetting(void) {
+	return resets != 0;
+}
+
+// The primary's keyboard just finished its self test: set it up again and
+// send it the LEDs, after the reset in boot.cpp or being plugged in
+static void selfTested(Converter &c, bool passed) {
+	boot_selfTest(passed);
+	scanset_begin(c.dec);
+	c.oldmodifier = c.modifier ^ MOD_NLOCK;
+}
+
+void converter_begin(Converter &c, HardwareSerial *port, byte rstPin, bool primary) {
+	c.rstPin = rstPin;
+	c.resetting = false;
+	c.primary = primary;
+	c.modifier = MOD_NLOCK;
+	c.oldmodifier = c.modifier;	// No LEDs until its self test, see boot.h
+	decode_reset(c.dec);
+	keys_reset(c.keys);
+	c.rep.key = 0;
+	tviq_begin(c.txq, port);
+	pinMode(rstPin, OUTPUT);
+	digitalWrite(rstPin, HIGH);
+	if (primary) {
+		pinMode(LED_PIN, OUTPUT);
+		hal_tickBegin(resetTick);
+	}
+}
+
+// Scan codes from http://www.vetra.com/scancodes.html et al
+
+// Handle one byte from the keyboard
+HAL_TIMED void converter_scan(Converter &c, byte scancode) {
+	byte keycode = 0;
+	byte xlatcode0 = 0;
+	byte xlatcode1 = 0;
+	uint16_t entry;
+	bool repeat = false;		// Typematic repeat of the key held down
+	byte key;			// Which key, as numbered in keys.h
+	byte action;
+	byte result;
+	uint16_t t = stats_start();
+
+
+	trace_put(TR_SCAN, scancode, 0);
+	if (c.primary && scanset_answer(scancode))
+		return;
+	if (c.primary && scancode == PS2_BAT_FAIL && boot_result == BOOT_WAITING) {
+		// Only taken as such when we're waiting for one
+		keys_reset(c.keys);
+		c.modifier &= (MOD_CLOCK|MOD_NLOCK);
+		decode_reset(c.dec);
+		selfTested(c, false);
+		return;
+	}
+	result = decode(c.dec, c.keys, scancode, &key);
+	stats_stage(ST_DECODE, t);
+	switch (result) {
+		case DEC_MAKE:
+			repeat = keys_press(c.keys, key);
+			c.modifier = (c.modifier & (MOD_CLOCK|MOD_NLOCK)) | keys_modifiers(c.keys);
+			if (repeat) {
+				typematic_heard(c.rep, key);
+				break;		// We make our own, see typematic.cpp
+			}
+			if (c.primary && macro_start(key, c.modifier))
+				break;		// Which types a string instead
+			action = decode_action(key);
+			if (action >= ' ') {
+				keycode = action;
+			} else if (action == ACT_CLOCK) {
+				c.modifier ^= MOD_CLOCK;
+			} else if (action == ACT_NLOCK) {
+				c.modifier ^= MOD_NLOCK;
+			} else if (action == ACT_NONE) {
+				stats_count(STAT_UNKNOWN);
+			} else if (action == ACT_SYSRQ) {
+				resetStart(c);
+			}
+			break;
+		case DEC_BREAK:
+			keys_release(c.keys, key);
+			c.modifier = (c.modifier & (MOD_CLOCK|MOD_NLOCK)) | keys_modifiers(c.keys);
+			break;
+		case DEC_PAUSE:
+			keycode = KEY_PAUSE;
+			key = 0;		// Which doesn't repeat
+			break;
+		case DEC_SPECIAL:
+			// Keyboard reset, plugged in or lost track: nothing is held now
+			keys_reset(c.keys);
+			c.modifier &= (MOD_CLOCK|MOD_NLOCK);
+			if (key == PS2_BAT_OK && c.primary)
+				selfTested(c, true);
+			break;
+		default:
+			return;			// Only part of a sequence so far
+	}
+	trace_put(TR_KEY, result, key);
+
+	if (keycode) {
+		// Generate tvi code: numlock, shift, alpha lock, control, ALT
+		// and the TVI code itself all come out of xlat_frame()
+		t = stats_start();
+		entry = xlat_frame(c.modifier, keycode);
+		xlatcode0 = entry >> 8;
+		xlatcode1 = entry & 0xFF;
+		t = stats_stage(ST_XLAT, t);
+
+		trace_put(TR_XLAT, xlatcode0, xlatcode1);
+		tviq_put(c.txq, xlatcode0, xlatcode1, false);
+		stats_stage(ST_ENQUEUE, t);
+
+		typematic_start(c.rep, key, c.modifier, xlatcode0, xlatcode1);
+	}
+	typematic_check(c.rep, c.keys, c.modifier);
+}
+
+// What ps2rx.cpp couldn't take.  A bad byte is asked for again, if it's
+// the primary's, and one lost for good means a break may be missing, so
+// start over the way the keyboard's own overrun code has us do.  Either way
+// the repeat stops.
+static void rxErrors(Converter &c) {
+	byte e = ps2rx_poll(c.rx);
+
+	if (e)
+		typematic_stop(c.rep);
+	if ((e & PS2RX_BAD) && !(c.primary && ps2cmd_resend()))
+		e |= PS2RX_LOST;
+	if (e & PS2RX_LOST)
+		converter_scan(c, PS2_OVERRUN);
+}
+
+// Drain the keyboard, unless the terminal's queue is full of keystrokes, in
+// which case they wait in ps2rx.cpp's ring and then the keyboard's buffer
+HAL_TIMED void converter_poll(Converter &c) {
+	byte scancode;
+
+	if (c.txq.hold != TVIQ_OPEN && !c.resetting)
+		tviq_hold(c.txq, TVIQ_OPEN);
+	tviq_pump(c.txq);
+	while (!tviq_full(c.txq) && (scancode = ps2rx_read(c.rx)))
+		converter_scan(c, scancode);
+	rxErrors(c);
+	typematic_poll(c.rep, c.keys, decode_repeats(c.dec), c.txq);
+
+	// No keycode, send LEDs if numlock/capslock changed
+	if (c.primary && ((c.oldmodifier ^ c.modifier) & (MOD_NLOCK|MOD_CLOCK))) {
+		sendLEDs(c.modifier);
+		c.oldmodifier = c.modifier;
+	}
+}
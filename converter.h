@@ -0,0 +1,73 @@
+/* converter.h, one keyboard and terminal pair
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Everything the converter knows about one keyboard and the terminal it
+// types on lives in a Converter, so one MCU can run CHANNELS of them from
+// the same loop().  Each pass reads what its keyboard has sent, while its
+// terminal's queue has room, and lets its repeat and LEDs catch up.
+//
+// Each reads its keyboard through its own ring and pins, see ps2rx.h, but
+// only converters[0], the primary, writes to its keyboard, with ps2cmd.cpp.
+// The others keep the keyboard's own LEDs and typematic and no scan code
+// set 3.  Macros, paste and the stats and trace replies are the primary's
+// too, see loop().
+
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+#include "keys.h"
+#include "decode.h"
+#include "tviq.h"
+#include "typematic.h"
+#include "ps2rx.h"
+
+// Sys-Rq holds the converter's reset line low this long, with LED_PIN lit,
+// while keys go on being read and sent.  The timer tick ends it.
+#define RESET_MS	500
+// and what happens to frames meanwhile: TVIQ_OPEN sends them as usual,
+// TVIQ_HOLD keeps them until it's over, and TVIQ_FLUSH throws away those
+// waiting and those typed during it
+#define RESET_POLICY	TVIQ_OPEN
+
+struct Converter {
+	byte rstPin;			// Pulsed low by Sys-Rq
+	volatile bool resetting;	// Until the timer tick lets it go
+	uint16_t resetLeft;		// Ticks to go, once started
+	bool primary;			// Owns ps2cmd.cpp and the LEDs
+	byte modifier;			// Modifiers and locks, MOD_
+	byte oldmodifier;		// The locks the LEDs show
+	Decoder dec;
+	Keys keys;
+	Typematic rep;
+	TviQueue txq;
+	Ps2Rx rx;			// From ps2rx_begin() on
+};
+
+extern Converter converters[CHANNELS];
+
+void converter_begin(Converter &c, HardwareSerial *port, byte rstPin,
+	bool primary);
+// One byte from its keyboard
+void converter_scan(Converter &c, byte scancode);
+void converter_poll(Converter &c);
+bool converter_resetting(void);		// LED_PIN is Sys-Rq's till false
+
+#endif
@@ -0,0 +1,252 @@
+/* decode.cpp, scan code set 2 decoder
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Each byte from the keyboard costs two table lookups: its class, then the
+// transition for (state, class), which gives the next state and what, if
+// anything, just happened.  Keys are reported by their number in keys.h,
+// and decode_actions says what each one does.
+//
+// A byte a state doesn't expect, like a code in the middle of the pause
+// sequence or an overrun after E0, drops the prefix collected so far and
+// is decoded again from idle, so a truncated sequence costs at most the
+// key it was part of.
+//
+// Set 3 (DECODE_SET3) has no prefixes but F0, and one byte per key, so it
+// takes a single lookup in set3_keys, which gives the set 2 key number.
+// Set 3 also has no Alt+PrtSc or Ctrl+Pause codes of its own, so those are
+// worked out from the modifiers held.
+
+#include "decode.h"
+#include "ps2cmd.h"
+#include "tvi_legacy.h"
+
+// Byte classes.  C_ALIAS are keys whose number with EXT_E0 added is another
+// key's, which no keyboard sends after E0, so they're dropped there.
+enum { C_CODE, C_E0, C_F0, C_E1, C_CTRL, C_NLOCK, C_SPECIAL, C_JUNK, C_ALIAS, NCLASSES };
+
+// States
+enum { S_IDLE, S_E0, S_F0, S_E0F0, S_E1, S_E1_14, S_E1F0, S_E1F0_14, S_E1F0_14F0, NSTATES };
+
+// A transition is the next state, the DEC_ result, and T_E0 when the key
+// came after an E0 (so the key number is the byte | T_E0)
+#define STATE_MASK	0x0F
+#define T_SHIFT		4
+#define T_MAKE		(DEC_MAKE << T_SHIFT)
+#define T_BREAK		(DEC_BREAK << T_SHIFT)
+#define T_PAUSE		(DEC_PAUSE << T_SHIFT)
+#define T_SPECIAL	(DEC_SPECIAL << T_SHIFT)
+#define T_RETRY		(7 << T_SHIFT)		// Back to idle and decode the byte again
+#define T_E0		EXT_E0
+
+#define RETRY	(S_IDLE | T_RETRY)
+
+static const byte transitions[NSTATES][NCLASSES] PROGMEM = {
+	//		  C_CODE			C_E0		C_F0		C_E1	C_CTRL			C_NLOCK			C_SPECIAL		C_JUNK	C_ALIAS
+	/* IDLE */	{ S_IDLE|T_MAKE,		S_E0,		S_F0,		S_E1,	S_IDLE|T_MAKE,		S_IDLE|T_MAKE,		S_IDLE|T_SPECIAL,	S_IDLE,	S_IDLE|T_MAKE },
+	/* E0 */	{ S_IDLE|T_MAKE|T_E0,		S_E0,		S_E0F0,		S_E1,	S_IDLE|T_MAKE|T_E0,	S_IDLE|T_MAKE|T_E0,	RETRY,			RETRY,	S_IDLE },
+	/* F0 */	{ S_IDLE|T_BREAK,		S_E0F0,		S_F0,		S_E1,	S_IDLE|T_BREAK,		S_IDLE|T_BREAK,		RETRY,			RETRY,	S_IDLE|T_BREAK },
+	/* E0F0 */	{ S_IDLE|T_BREAK|T_E0,		S_E0F0,		S_E0F0,		S_E1,	S_IDLE|T_BREAK|T_E0,	S_IDLE|T_BREAK|T_E0,	RETRY,			RETRY,	S_IDLE },
+	// Pause sends E1 14 77 E1 F0 14 F0 77
+	/* E1 */	{ RETRY,			RETRY,		S_E1F0,		S_E1,	S_E1_14,		RETRY,			RETRY,			RETRY,	RETRY },
+	/* E1 14 */	{ RETRY,			RETRY,		RETRY,		RETRY,	RETRY,			S_IDLE|T_PAUSE,		RETRY,			RETRY,	RETRY },
+	/* E1 F0 */	{ RETRY,			RETRY,		RETRY,		RETRY,	S_E1F0_14,		RETRY,			RETRY,			RETRY,	RETRY },
+	/* E1F014 */	{ RETRY,			RETRY,		S_E1F0_14F0,	RETRY,	RETRY,			RETRY,			RETRY,			RETRY,	RETRY },
+	/* E1F014F0 */	{ RETRY,			RETRY,		RETRY,		RETRY,	RETRY,			S_IDLE,			RETRY,			RETRY,	RETRY },
+};
+
+static constexpr byte byteClass(unsigned b) {
+	return b == 0xE0 ? C_E0
+		: b == 0xF0 ? C_F0
+		: b == 0xE1 ? C_E1
+		: b == SCAN_CTRL ? C_CTRL
+		: b == SCAN_NLOCK ? C_NLOCK
+		: (b == PS2_BAT_OK || b == PS2_OVERRUN) ? C_SPECIAL
+		: (b == 0 || b > SCAN_SYSRQ) ? C_JUNK	// No key sends these
+		: (b | EXT_E0) <= SCAN_SYSRQ ? C_ALIAS
+		: C_CODE;
+}
+
+static constexpr byte e0Key(byte code) {
+	return code == SCAN_E0_END ? KEY_E0_END
+		: code == SCAN_E0_LEFT ? KEY_E0_LEFT
+		: code == SCAN_E0_HOME ? KEY_E0_HOME
+		: code == SCAN_E0_INS ? KEY_E0_INS
+		: code == SCAN_E0_DEL ? KEY_E0_DEL
+		: code == SCAN_E0_DOWN ? KEY_E0_DOWN
+		: code == SCAN_E0_RIGHT ? KEY_E0_RIGHT
+		: code == SCAN_E0_UP ? KEY_E0_UP
+		: code == SCAN_E0_PGDN ? KEY_E0_PGDN
+		: code == SCAN_E0_PGUP ? KEY_E0_PGUP
+		: code == SCAN_E0_KPSL ? KEY_KP_SLASH
+		: code == SCAN_E0_KPENT ? KEY_KP_ENTER
+		: code == SCAN_E0_PRTSC ? KEY_PRTSC
+		: code == SCAN_E0_BREAK ? KEY_BREAK
+		: 0;
+}
+
+// Plain codes go up to 84, the E0 ones start at EXT_E0 + 10
+static constexpr byte keyAction(unsigned key) {
+	return key == SCAN_CLOCK ? ACT_CLOCK
+		: key == SCAN_NLOCK ? ACT_NLOCK
+		: key == SCAN_SYSRQ ? ACT_SYSRQ
+		: (key & ~EXT_E0) == SCAN_LSHIFT || (key & ~EXT_E0) == SCAN_RSHIFT
+		|| (key & ~EXT_E0) == SCAN_CTRL || (key & ~EXT_E0) == SCAN_ALT ? ACT_MOD
+		: key < NUM_PS2SCAN ? ps2_to_intermediate[key]
+		: key >= EXT_E0 ? e0Key(key - EXT_E0)
+		: ACT_NONE;
+}
+
+#define DEC_E1(f, i)	f(i)
+#define DEC_E4(f, i)	DEC_E1(f, i), DEC_E1(f, (i)+1), DEC_E1(f, (i)+2), DEC_E1(f, (i)+3)
+#define DEC_E16(f, i)	DEC_E4(f, i), DEC_E4(f, (i)+4), DEC_E4(f, (i)+8), DEC_E4(f, (i)+12)
+#define DEC_E64(f, i)	DEC_E16(f, i), DEC_E16(f, (i)+16), DEC_E16(f, (i)+32), DEC_E16(f, (i)+48)
+#define DEC_E256(f)	DEC_E64(f, 0), DEC_E64(f, 64), DEC_E64(f, 128), DEC_E64(f, 192)
+
+static constexpr byte classes[256] PROGMEM = { DEC_E256(byteClass) };
+
+constexpr byte decode_actions[256] PROGMEM = { DEC_E256(keyAction) };
+
+static_assert(DEC_SPECIAL < 7 && NSTATES <= STATE_MASK + 1, "transitions don't fit a byte");
+static_assert(ACT_MOD < ' ' && KEY_F1 >= ' ', "actions and keycodes overlap");
+static_assert(SCAN_SYSRQ == NUM_PS2SCAN && EXT_E0 + 0x10 > SCAN_SYSRQ,
+	"plain and E0 key numbers overlap");
+
+static_assert(S_IDLE == 0, "a Decoder starts out zeroed");
+
+void decode_reset(Decoder &d) {
+	d.state = S_IDLE;
+}
+
+#ifdef DECODE_SET3
+
+// Set 3 make codes as set 2 key numbers, 0 for no key
+#define S3_PRTSC	0x57
+#define S3_PAUSE	0x62
+
+static constexpr byte set3Key(unsigned c) {
+	return c == 0x08 ? 0x76			// Esc
+		: c == 0x07 ? 0x05		// F1 - F12
+		: c == 0x0F ? 0x06
+		: c == 0x17 ? 0x04
+		: c == 0x1F ? 0x0C
+		: c == 0x27 ? 0x03
+		: c == 0x2F ? 0x0B
+		: c == 0x37 ? 0x83
+		: c == 0x3F ? 0x0A
+		: c == 0x47 ? 0x01
+		: c == 0x4F ? 0x09
+		: c == 0x56 ? 0x78
+		: c == 0x5E ? 0x07
+		: c == S3_PRTSC ? EXT_E0 | SCAN_E0_PRTSC
+		: c == 0x5F ? 0x7E		// Scroll lock
+		: c == S3_PAUSE ? EXT_E0 | SCAN_E0_BREAK
+		: c == S3_CLOCK ? SCAN_CLOCK
+		: c == 0x11 ? SCAN_CTRL
+		: c == 0x19 ? SCAN_ALT
+		: c == 0x39 ? EXT_E0 | SCAN_ALT
+		: c == 0x58 ? EXT_E0 | SCAN_CTRL
+		: c == 0x5C ? 0x5D		// Backslash
+		: c == 0x13 ? 0x61		// The 102nd key
+		: c == 0x8B ? EXT_E0 | 0x1F	// Windows and menu keys
+		: c == 0x8C ? EXT_E0 | 0x27
+		: c == 0x8D ? EXT_E0 | 0x2F
+		: c == 0x67 ? EXT_E0 | SCAN_E0_INS
+		: c == 0x6E ? EXT_E0 | SCAN_E0_HOME
+		: c == 0x6F ? EXT_E0 | SCAN_E0_PGUP
+		: c == 0x64 ? EXT_E0 | SCAN_E0_DEL
+		: c == 0x65 ? EXT_E0 | SCAN_E0_END
+		: c == 0x6D ? EXT_E0 | SCAN_E0_PGDN
+		: c == 0x63 ? EXT_E0 | SCAN_E0_UP
+		: c == 0x61 ? EXT_E0 | SCAN_E0_LEFT
+		: c == 0x60 ? EXT_E0 | SCAN_E0_DOWN
+		: c == 0x6A ? EXT_E0 | SCAN_E0_RIGHT
+		: c == S3_NLOCK ? SCAN_NLOCK
+		: c == 0x77 ? EXT_E0 | SCAN_E0_KPSL
+		: c == 0x7E ? 0x7C		// Keypad *, -, +, enter
+		: c == 0x84 ? 0x7B
+		: c == 0x7C ? 0x79
+		: c == 0x79 ? EXT_E0 | SCAN_E0_KPENT
+		// The rest of the main block and keypad are the same as set 2
+		: (c >= 0x0D && c <= 0x0E) || c == 0x12 || (c >= 0x15 && c <= 0x16)
+		|| (c >= 0x1A && c <= 0x1E) || (c >= 0x21 && c <= 0x26)
+		|| (c >= 0x29 && c <= 0x2E) || (c >= 0x31 && c <= 0x36)
+		|| (c >= 0x3A && c <= 0x3E) || (c >= 0x41 && c <= 0x46)
+		|| (c >= 0x49 && c <= 0x4E) || c == 0x52 || (c >= 0x54 && c <= 0x55)
+		|| c == 0x59 || (c >= 0x5A && c <= 0x5B) || c == 0x66
+		|| (c >= 0x69 && c <= 0x75 && c != 0x6A && c != 0x6D && c != 0x6E && c != 0x6F)
+		|| c == 0x7A || c == 0x7D ? c
+		: 0;
+}
+
+static constexpr byte set3_keys[256] PROGMEM = { DEC_E256(set3Key) };
+
+void decode_set3(Decoder &d, bool on) {
+	d.set3 = on;
+}
+
+static byte decode3(Decoder &d, Keys &keys, byte scancode, byte *key) {
+	bool brk = d.state == S_F0;
+	byte k;
+
+	if (scancode == 0xF0) {
+		d.state = S_F0;
+		return DEC_NONE;
+	}
+	d.state = S_IDLE;
+	*key = scancode;
+	if (scancode == PS2_BAT_OK || scancode == PS2_OVERRUN)
+		return DEC_SPECIAL;
+	k = pgm_read_byte(&set3_keys[scancode]);
+
+	if (scancode == S3_PRTSC) {
+		// PrtSc, or SysRq with alt held
+		if (brk ? keys_isDown(keys, SCAN_SYSRQ) : keys_modifiers(keys) & (MOD_LALT|MOD_RALT))
+			k = SCAN_SYSRQ;
+	} else if (scancode == S3_PAUSE) {
+		// Pause, or Break with control held.  Pause has no break.
+		if (brk ? !keys_isDown(keys, k) : !(keys_modifiers(keys) & (MOD_LCTRL|MOD_RCTRL))) {
+			*key = 0;
+			return brk ? DEC_NONE : DEC_PAUSE;
+		}
+	} else if (scancode == S3_CLOCK || scancode == S3_NLOCK) {
+		keys_release(keys, k);	// Make only, see scanset.cpp
+	}
+	*key = k;
+	return brk ? DEC_BREAK : DEC_MAKE;
+}
+
+#endif
+
+// Feed one byte, returns DEC_ and sets *key for makes, breaks and specials
+byte decode(Decoder &d, Keys &keys, byte scancode, byte *key) {
+#	ifdef DECODE_SET3
+	if (d.set3)
+		return decode3(d, keys, scancode, key);
+#	else
+	(void)keys;
+#	endif
+	byte c = pgm_read_byte(&classes[scancode]);
+	byte t = pgm_read_byte(&transitions[d.state][c]);
+
+	if ((t & T_RETRY) == T_RETRY)
+		t = pgm_read_byte(&transitions[S_IDLE][c]);
+	d.state = t & STATE_MASK;
+	*key = scancode | (t & T_E0);
+	return (t >> T_SHIFT) & 7;
+}
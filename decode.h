@@ -0,0 +1,81 @@
+/* decode.h, scan code set 2 decoder
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+#include "keys.h"
+
+// What a byte from the keyboard turned out to be
+#define DEC_NONE	0	// Part of a prefix, or nothing
+#define DEC_MAKE	1	// Key pressed, or repeating
+#define DEC_BREAK	2	// Key released
+#define DEC_PAUSE	3	// The pause key, which has no break
+#define DEC_SPECIAL	4	// Self test passed or overrun, the byte itself
+
+// What a key does, from decode_action(): an intermediate keycode (0x20 and
+// up) or one of these
+#define ACT_NONE	0	// Unknown keys
+#define ACT_CLOCK	1
+#define ACT_NLOCK	2
+#define ACT_SYSRQ	3
+#define ACT_MOD		4	// Shift, control and alt, see keys_modifiers()
+
+// Define DECODE_SET3 to switch the keyboard to scan code set 3 after each
+// reset, see scanset.cpp.  Keyboards that don't have it stay in set 2.
+// #define DECODE_SET3
+
+extern const byte decode_actions[256] PROGMEM;
+
+// Where one keyboard's byte stream is up to
+struct Decoder {
+	byte state;			// Of the state machine, or F0 seen in set 3
+#	ifdef DECODE_SET3
+	bool set3;			// Which set the keyboard is sending
+#	endif
+};
+
+// Set 3 needs to know which modifiers are held, so it gets the key map too
+byte decode(Decoder &d, Keys &k, byte scancode, byte *key);
+void decode_reset(Decoder &d);
+#ifdef DECODE_SET3
+void decode_set3(Decoder &d, bool on);
+
+// Set 3 keys we only need the make of, as their set 3 codes
+#define S3_CLOCK	0x14
+#define S3_NLOCK	0x76
+#endif
+
+// Whether the keyboard sends its own repeats, see typematic_poll()
+static inline bool decode_repeats(const Decoder &d) {
+#	ifdef DECODE_SET3
+	return !d.set3;
+#	else
+	(void)d;
+	return true;
+#	endif
+}
+
+static inline byte decode_action(byte key) {
+	return pgm_read_byte(&decode_actions[key]);
+}
+
+#endif
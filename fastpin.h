@@ -0,0 +1,141 @@
+/* fastpin.h, compile time pin access for the PS/2 lines
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// FastPin<n> does what pinMode(), digitalWrite() and digitalRead() do for
+// Arduino pin n, but with the port and bit worked out at compile time, so
+// on the AVR each is a single sbi, cbi or sbic/in instead of a digital*()
+// call of 50 or more cycles that looks the pin up in flash.  Only the
+// ATmega328 (Uno, Nano, Pro Mini) pin map is known.  On other MCUs, the
+// Mega for one, pin 3 is somewhere else entirely, so there each access
+// looks the port and bit up in the core's tables the way digital*() do,
+// less the rest of their checks: slower, but the right pin.
+//
+// On the host they go to the emulated pins like everything else, but
+// cheaper, see hal_fastRead() in host/hal_linux.cpp.
+
+#ifndef FASTPIN_H
+#define FASTPIN_H
+
+#include "hal.h"
+
+#if defined(ARDUINO) && (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) \
+		|| defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__))
+
+template <byte PIN>
+struct FastPin {
+	static_assert(PIN < 20, "FastPin only knows the ATmega328 pins");
+
+	static constexpr byte mask = 1 << (PIN < 8 ? PIN : PIN < 14 ? PIN - 8 : PIN - 14);
+
+	static inline volatile uint8_t &in(void) {
+		return PIN < 8 ? PIND : PIN < 14 ? PINB : PINC;
+	}
+	static inline volatile uint8_t &out(void) {
+		return PIN < 8 ? PORTD : PIN < 14 ? PORTB : PORTC;
+	}
+	static inline volatile uint8_t &ddr(void) {
+		return PIN < 8 ? DDRD : PIN < 14 ? DDRB : DDRC;
+	}
+
+	static inline bool read(void) {
+		return in() & mask;
+	}
+	static inline void write(bool high) {
+		if (high)
+			out() |= mask;
+		else
+			out() &= ~mask;
+	}
+	static inline void output(void) {
+		ddr() |= mask;
+	}
+	// Let go of an open collector line: input, pulled up
+	static inline void release(void) {
+		ddr() &= ~mask;
+		out() |= mask;
+	}
+};
+
+#elif defined(ARDUINO)
+
+template <byte PIN>
+struct FastPin {
+	static inline volatile uint8_t &in(void) {
+		return *portInputRegister(digitalPinToPort(PIN));
+	}
+	static inline volatile uint8_t &out(void) {
+		return *portOutputRegister(digitalPinToPort(PIN));
+	}
+	static inline volatile uint8_t &ddr(void) {
+		return *portModeRegister(digitalPinToPort(PIN));
+	}
+
+	static inline bool read(void) {
+		return in() & digitalPinToBitMask(PIN);
+	}
+	// Not single instructions here, so keep interrupts out of the
+	// read-modify-write the way digitalWrite() does
+	static inline void write(bool high) {
+		byte mask = digitalPinToBitMask(PIN), s = SREG;
+
+		cli();
+		if (high)
+			out() |= mask;
+		else
+			out() &= ~mask;
+		SREG = s;
+	}
+	static inline void output(void) {
+		byte mask = digitalPinToBitMask(PIN), s = SREG;
+
+		cli();
+		ddr() |= mask;
+		SREG = s;
+	}
+	static inline void release(void) {
+		byte mask = digitalPinToBitMask(PIN), s = SREG;
+
+		cli();
+		ddr() &= ~mask;
+		out() |= mask;
+		SREG = s;
+	}
+};
+
+#else
+
+template <byte PIN>
+struct FastPin {
+	static inline bool read(void) {
+		return hal_fastRead(PIN);
+	}
+	static inline void write(bool high) {
+		hal_fastWrite(PIN, high);
+	}
+	static inline void output(void) {
+		hal_fastMode(PIN, OUTPUT);
+	}
+	static inline void release(void) {
+		hal_fastMode(PIN, INPUT_PULLUP);
+	}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,170 @@
+/* hal.h, the hardware abstraction layer for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The converter only touches the hardware through the small subset of the
+// Arduino API declared here.  On the AVR that's just the Arduino core and
+// SoftwareSerial for paste.cpp.  Everywhere else
+// (ARDUINO not defined) the same names are provided by host/hal_linux.cpp,
+// which runs on a virtual clock, feeds scan codes from a script and
+// captures everything sent to Serial, so the whole loop() pipeline builds
+// and runs as a Linux executable.
+
+#ifndef HAL_H
+#define HAL_H
+
+// Period of hal_tickBegin() callbacks: once per timer 0 overflow at 16MHz
+#define HAL_TICK_US	1024
+#define HAL_TICK_FNS	2		// How many there can be
+// Resolution of hal_stamp(), timer 1 at clock/8, so it wraps every 32.8ms
+#define HAL_STAMP_NS	500
+// On a routine in sim/budget.txt, so LTO can't fold it into its caller and
+// leave sim/tvi_sim.cpp nothing to time
+#define HAL_TIMED	__attribute__((noinline))
+
+#ifdef ARDUINO
+
+// ---- AVR backend ----
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+// Serial.availableForWrite() with nothing waiting to go out
+#define HAL_SERIAL_TX	(SERIAL_TX_BUFFER_SIZE - 1)
+
+// Sleep until the next interrupt: a PS/2 clock edge, the UART, or at the
+// latest the 1.024ms timer 0 tick that runs millis().  A byte finishing
+// between loop() draining ps2rx.cpp's rings and the sleep instruction waits
+// for that tick, never longer.
+static inline void hal_idle(void) {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	noInterrupts();
+	sleep_enable();
+	interrupts();
+	sleep_cpu();
+	sleep_disable();
+}
+
+// Forget a falling edge latched while the pin's interrupt was detached, so
+// attaching a handler doesn't run it straight away.  The core numbers a
+// Mega's INT4 and INT5 first, on pins 2 and 3, then INT0 - INT3.
+static inline void hal_clearPendingIrq(byte pin) {
+	byte n = digitalPinToInterrupt(pin);
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+	n = n < 2 ? n + 4 : n - 2;
+#endif
+	EIFR = bit(n);
+}
+
+// Call fn from the timer 0 compare A interrupt every HAL_TICK_US, as well as
+// any given before, see hal_avr.cpp
+void hal_tickBegin(void (*fn)(void));
+
+// Free running timer for measuring short stretches of code, a few cycles to read
+void hal_stampBegin(void);
+static inline uint16_t hal_stamp(void) {
+	return TCNT1;
+}
+
+// The host's books on its keyboards and ps2rx.cpp's rings, nothing here
+static inline void hal_ps2Begin(byte, byte, byte) {}
+static inline void hal_ps2Put(byte) {}
+static inline void hal_ps2Taken(byte) {}
+
+#else
+
+// ---- Linux backend, see host/hal_linux.cpp ----
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t byte;
+
+#define HAL_SERIAL_TX	63
+
+#define LOW		0
+#define HIGH		1
+#define INPUT		0
+#define OUTPUT		1
+#define INPUT_PULLUP	2
+#define SERIAL_8N1	0x06
+#define FALLING		2
+
+#define digitalPinToInterrupt(p)	(p)
+
+// Flash and RAM share one address space here
+#define PROGMEM
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+#define pgm_read_ptr(p)		(*(const void * const *)(p))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis(void);
+unsigned long micros(void);
+void noInterrupts(void);
+void interrupts(void);
+void attachInterrupt(uint8_t num, void (*fn)(void), int mode);
+void detachInterrupt(uint8_t num);
+void hal_idle(void);
+void hal_clearPendingIrq(byte pin);
+void hal_tickBegin(void (*fn)(void));
+void hal_stampBegin(void);
+uint16_t hal_stamp(void);
+void hal_ps2Begin(byte ch, byte clk, byte data);	// Keyboard ch is on these pins
+void hal_ps2Put(byte ch);		// A byte went into its ring
+void hal_ps2Taken(byte ch);		// and loop() took one out
+
+// What fastpin.h uses, the same as the digital*() calls but cheaper
+void hal_fastMode(uint8_t pin, uint8_t mode);
+void hal_fastWrite(uint8_t pin, uint8_t val);
+int hal_fastRead(uint8_t pin);
+
+// Captured serial sinks; bytes are timestamped and paced at the configured baud
+class HardwareSerial {
+	uint8_t line;
+public:
+	constexpr HardwareSerial(uint8_t n) : line(n) {}
+	void begin(unsigned long baud, byte config = SERIAL_8N1);
+	int available(void);
+	int read(void);
+	int availableForWrite(void);
+	size_t write(uint8_t c);
+	size_t write(const char *str);
+	size_t write(const uint8_t *buf, size_t len);
+};
+extern HardwareSerial Serial, Serial1, Serial2, Serial3;
+
+// The second port, bit banged on any two pins, see paste.cpp
+class SoftwareSerial {
+public:
+	SoftwareSerial(uint8_t rxPin, uint8_t txPin);
+	void begin(long baud);
+	int available(void);
+	int read(void);
+	size_t write(uint8_t c);
+	bool overflow(void);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+/* hal_avr.cpp, the parts of the AVR backend of hal.h that need an ISR
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef ARDUINO
+
+#include "hal.h"
+
+static void (*tickFns[HAL_TICK_FNS])(void);
+static byte nTickFns;
+
+// Timer 0 overflows run millis(); compare A on the same timer is free and
+// matches once per overflow, half way through
+ISR(TIMER0_COMPA_vect) {
+	byte i;
+
+	for (i=0; i<nTickFns; i++)
+		tickFns[i]();
+}
+
+void hal_tickBegin(void (*fn)(void)) {
+	if (nTickFns == HAL_TICK_FNS)
+		return;
+	tickFns[nTickFns++] = fn;
+	OCR0A = 0x80;
+	TIMSK0 |= bit(OCIE0A);
+}
+
+// Timer 1 is otherwise unused: count at clock/8 with no outputs or interrupts
+void hal_stampBegin(void) {
+	TCCR1A = 0;
+	TCCR1B = bit(CS11);
+}
+
+#endif
@@ -0,0 +1,200 @@
+/* evdev.cpp, Linux input devices as PS/2 keys, for tvi_evdev
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include "evdev.h"
+
+#ifndef input_event_sec
+#define input_event_sec		time.tv_sec
+#define input_event_usec	time.tv_usec
+#endif
+
+// Event codes to key numbers (set 2 make codes, E0 ones + 0x80), for the
+// keys of a PC/AT keyboard; the rest are left out, as the converter would
+// do with anything it doesn't know
+static const struct {
+	uint16_t code;
+	uint8_t key;
+} keymap[] = {
+	{ KEY_ESC, 0x76 },	{ KEY_F1, 0x05 },	{ KEY_F2, 0x06 },
+	{ KEY_F3, 0x04 },	{ KEY_F4, 0x0C },	{ KEY_F5, 0x03 },
+	{ KEY_F6, 0x0B },	{ KEY_F7, 0x83 },	{ KEY_F8, 0x0A },
+	{ KEY_F9, 0x01 },	{ KEY_F10, 0x09 },	{ KEY_F11, 0x78 },
+	{ KEY_F12, 0x07 },
+
+	{ KEY_GRAVE, 0x0E },	{ KEY_1, 0x16 },	{ KEY_2, 0x1E },
+	{ KEY_3, 0x26 },	{ KEY_4, 0x25 },	{ KEY_5, 0x2E },
+	{ KEY_6, 0x36 },	{ KEY_7, 0x3D },	{ KEY_8, 0x3E },
+	{ KEY_9, 0x46 },	{ KEY_0, 0x45 },	{ KEY_MINUS, 0x4E },
+	{ KEY_EQUAL, 0x55 },	{ KEY_BACKSPACE, 0x66 },
+
+	{ KEY_TAB, 0x0D },	{ KEY_Q, 0x15 },	{ KEY_W, 0x1D },
+	{ KEY_E, 0x24 },	{ KEY_R, 0x2D },	{ KEY_T, 0x2C },
+	{ KEY_Y, 0x35 },	{ KEY_U, 0x3C },	{ KEY_I, 0x43 },
+	{ KEY_O, 0x44 },	{ KEY_P, 0x4D },	{ KEY_LEFTBRACE, 0x54 },
+	{ KEY_RIGHTBRACE, 0x5B },	{ KEY_BACKSLASH, 0x5D },
+
+	{ KEY_CAPSLOCK, 0x58 },	{ KEY_A, 0x1C },	{ KEY_S, 0x1B },
+	{ KEY_D, 0x23 },	{ KEY_F, 0x2B },	{ KEY_G, 0x34 },
+	{ KEY_H, 0x33 },	{ KEY_J, 0x3B },	{ KEY_K, 0x42 },
+	{ KEY_L, 0x4B },	{ KEY_SEMICOLON, 0x4C },	{ KEY_APOSTROPHE, 0x52 },
+	{ KEY_ENTER, 0x5A },
+
+	{ KEY_LEFTSHIFT, 0x12 },	{ KEY_102ND, 0x61 },	{ KEY_Z, 0x1A },
+	{ KEY_X, 0x22 },	{ KEY_C, 0x21 },	{ KEY_V, 0x2A },
+	{ KEY_B, 0x32 },	{ KEY_N, 0x31 },	{ KEY_M, 0x3A },
+	{ KEY_COMMA, 0x41 },	{ KEY_DOT, 0x49 },	{ KEY_SLASH, 0x4A },
+	{ KEY_RIGHTSHIFT, 0x59 },
+
+	{ KEY_LEFTCTRL, 0x14 },	{ KEY_LEFTMETA, 0x9F },	{ KEY_LEFTALT, 0x11 },
+	{ KEY_SPACE, 0x29 },	{ KEY_RIGHTALT, 0x91 },	{ KEY_RIGHTMETA, 0xA7 },
+	{ KEY_COMPOSE, 0xAF },	{ KEY_RIGHTCTRL, 0x94 },
+
+	{ KEY_SYSRQ, 0xFC },	{ KEY_PRINT, 0xFC },	{ KEY_SCROLLLOCK, 0x7E },
+	{ KEY_PAUSE, EVDEV_PAUSE },
+
+	{ KEY_INSERT, 0xF0 },	{ KEY_HOME, 0xEC },	{ KEY_PAGEUP, 0xFD },
+	{ KEY_DELETE, 0xF1 },	{ KEY_END, 0xE9 },	{ KEY_PAGEDOWN, 0xFA },
+	{ KEY_UP, 0xF5 },	{ KEY_LEFT, 0xEB },	{ KEY_DOWN, 0xF2 },
+	{ KEY_RIGHT, 0xF4 },
+
+	{ KEY_NUMLOCK, 0x77 },	{ KEY_KPSLASH, 0xCA },	{ KEY_KPASTERISK, 0x7C },
+	{ KEY_KPMINUS, 0x7B },	{ KEY_KP7, 0x6C },	{ KEY_KP8, 0x75 },
+	{ KEY_KP9, 0x7D },	{ KEY_KPPLUS, 0x79 },	{ KEY_KP4, 0x6B },
+	{ KEY_KP5, 0x73 },	{ KEY_KP6, 0x74 },	{ KEY_KP1, 0x69 },
+	{ KEY_KP2, 0x72 },	{ KEY_KP3, 0x7A },	{ KEY_KPENTER, 0xDA },
+	{ KEY_KP0, 0x70 },	{ KEY_KPDOT, 0x71 },
+};
+
+// No E0 code is below 0x10, see keys.h, so these are the ones after E0
+#define FIRST_E0	0x90
+
+static uint8_t byCode[KEY_CNT];
+
+static void buildMap(void) {
+	size_t i;
+
+	if (byCode[KEY_ESC])
+		return;
+	for (i=0; i<sizeof(keymap)/sizeof(keymap[0]); i++)
+		byCode[keymap[i].code] = keymap[i].key;
+}
+
+int evdev_open(const char *path, bool grab) {
+	struct stat st;
+	int fd, clk = CLOCK_MONOTONIC;
+
+	// Devices are opened for writing too, for the LEDs; pipes aren't, or
+	// we'd read the LED events back
+	if (stat(path, &st) < 0)
+		return -1;
+	fd = open(path, (S_ISCHR(st.st_mode) ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0 && errno == EACCES)
+		fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	buildMap();
+	// Pipes have no clock to set, their writer uses CLOCK_MONOTONIC
+	ioctl(fd, EVIOCSCLOCKID, &clk);
+	if (grab && ioctl(fd, EVIOCGRAB, 1) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int evdev_read(int fd, EvdevKey *k) {
+	struct input_event ev;
+	ssize_t n;
+
+	for (;;) {
+		n = read(fd, &ev, sizeof(ev));
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		if (n != sizeof(ev))
+			return -1;	// Unplugged, or the pipe closed
+		if (ev.type != EV_KEY || ev.code >= KEY_CNT || !byCode[ev.code] || ev.value > 2)
+			continue;
+		k->key = byCode[ev.code];
+		k->value = ev.value;
+		k->us = ev.input_event_sec * 1000000ULL + ev.input_event_usec;
+		return 1;
+	}
+}
+
+size_t evdev_scancodes(uint8_t key, bool down, uint8_t *out) {
+	static const uint8_t pause[] = { 0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77 };
+	uint8_t *o = out;
+
+	if (key == EVDEV_PAUSE) {
+		if (!down)
+			return 0;	// The keyboard sends it all on the way down
+		memcpy(out, pause, sizeof(pause));
+		return sizeof(pause);
+	}
+	if (key >= FIRST_E0)
+		*o++ = 0xE0;
+	if (!down)
+		*o++ = 0xF0;
+	*o++ = key >= FIRST_E0 ? key & 0x7F : key;
+	return o - out;
+}
+
+void evdev_leds(int fd, bool caps, bool num) {
+	struct input_event ev[3];
+
+	memset(ev, 0, sizeof(ev));
+	ev[0].type = ev[1].type = EV_LED;
+	ev[0].code = LED_CAPSL;
+	ev[0].value = caps;
+	ev[1].code = LED_NUML;
+	ev[1].value = num;
+	ev[2].type = EV_SYN;
+	ev[2].code = SYN_REPORT;
+	if (write(fd, ev, sizeof(ev)) < 0)
+		return;		// Opened read only
+}
+
+unsigned evdev_code(uint8_t key) {
+	size_t i;
+
+	for (i=0; i<sizeof(keymap)/sizeof(keymap[0]); i++)
+		if (keymap[i].key == key)
+			return keymap[i].code;
+	return 0;
+}
+
+bool evdev_write(int fd, uint8_t key, uint8_t value, uint64_t us) {
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.input_event_sec = us / 1000000;
+	ev.input_event_usec = us % 1000000;
+	ev.type = EV_KEY;
+	ev.code = evdev_code(key);
+	ev.value = value;
+	return write(fd, &ev, sizeof(ev)) == sizeof(ev);
+}
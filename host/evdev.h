@@ -0,0 +1,60 @@
+/* evdev.h, Linux input devices as PS/2 keys, for tvi_evdev
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// <linux/input.h> has its own KEY_F1 and so on, which aren't the ones in
+// PS2_TVI.h, so it stays inside evdev.cpp.  Everything out of here is in
+// the converter's terms: keys numbered as in keys.h, and the set 2 scan
+// codes a PS/2 keyboard would have sent for them, for tvi_translate().
+
+#ifndef EVDEV_H
+#define EVDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EVDEV_PAUSE	0xFF	// Not a key number: Pause, which sends E1 14 77
+#define EVDEV_MAXSCAN	8	// Scan codes for one key going down or up
+
+// A key going down (1), up (0) or repeating (2), at us on CLOCK_MONOTONIC
+struct EvdevKey {
+	uint8_t key;
+	uint8_t value;
+	uint64_t us;
+};
+
+// Open a device, or anything else that gives struct input_event, such as a
+// pipe.  With grab nothing else (the console) sees its keys.  -1 on error.
+int evdev_open(const char *path, bool grab);
+
+// The next key the converter knows from fd, which is non-blocking.  1 with
+// *k filled in, 0 if nothing more is waiting, -1 when the device is gone.
+int evdev_read(int fd, EvdevKey *k);
+
+// Set 2 scan codes for key into out, returns how many
+size_t evdev_scancodes(uint8_t key, bool down, uint8_t *out);
+
+// Keyboard LEDs, as the converter keeps them
+void evdev_leds(int fd, bool caps, bool num);
+
+// For tests: the event code for key, 0 if there's none, and sending one
+// down a pipe as a device would
+unsigned evdev_code(uint8_t key);
+bool evdev_write(int fd, uint8_t key, uint8_t value, uint64_t us);
+
+#endif
@@ -0,0 +1,85 @@
+/* hal_host.h, controls for the Linux backend of hal.h
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The host tools drive the converter through these.  All times are in
+// microseconds of virtual time; nothing here ever sleeps for real.
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+#include "../hal.h"
+
+// Virtual clock
+uint64_t host_now(void);
+void host_advance(uint64_t us);
+
+// Emulated PS/2 keyboard on the primary's clock/data pins
+void host_kbdQueue(uint8_t code, uint64_t at);	// Device sends code no earlier than at
+size_t host_kbdPending(void);			// Codes not yet read by the converter
+uint64_t host_kbdLastScan(void);		// When the last code read had arrived
+const uint8_t *host_kbdCommands(size_t *n);	// Bytes the converter sent to the keyboard
+void host_kbdNak(unsigned n);			// Answer the next n bytes with 0xFE
+void host_kbdUnplug(bool unplugged);		// Stop answering the host at all
+void host_kbdGarble(unsigned every);		// Send every n'th byte with bad parity, 0 for none
+void host_kbdBatFail(bool fails);		// Fail the self test after a reset
+void host_kbdSet3(bool has);			// Offer scan code set 3; scripts must match
+
+// The keyboards of the other converters, see converter.h, each on the pins
+// of its channel.  Line n is channel n's keyboard and the terminal on
+// Serialn.
+void host_kbdQueueOn(uint8_t line, uint8_t code, uint64_t at);	// Line 0 is host_kbdQueue()
+size_t host_kbdPendingOn(uint8_t line);
+
+// Emulated PC on the SoftwareSerial port, sending as fast as CTS lets it
+void host_pasteCts(uint8_t pin);		// The converter holds pin low to let it send
+void host_pasteQueue(const uint8_t *buf, size_t n, uint64_t at);
+size_t host_pastePending(void);			// Not yet read by the converter
+unsigned long host_pasteLost(void);		// Overran SoftwareSerial's buffer
+const uint8_t *host_pasteLog(size_t *n);	// What the converter sent back
+
+// Captured serial sink
+struct HostTx {
+	uint8_t c;
+	uint64_t written;	// When Serial.write() took it
+	uint64_t sent;		// When the UART finished shifting it out
+	uint64_t scan;		// Arrival of the last scan code read before it
+};
+const HostTx *host_serialLog(size_t *n);
+const HostTx *host_serialLogOn(uint8_t line, size_t *n);	// Serial1 - Serial3
+void host_serialRx(const uint8_t *buf, size_t n);	// The terminal sends these now
+
+// Interrupt and sleep bookkeeping
+uint64_t host_maxIrqOff(void);			// Longest noInterrupts() window
+uint64_t host_sleepTime(void);			// Total time spent in hal_idle()
+unsigned long host_wakeups(void);
+
+// Virtual cost charged per pin access, in us (about a digitalRead on a 16MHz AVR)
+#define HOST_PINIO_US	3
+// ... and for a FastPin<> access, really 1 or 2 cycles
+#define HOST_FASTIO_US	1
+// ... and for taking an interrupt out of sleep and running a pass of loop()
+#define HOST_WAKE_US	10
+// Bytes a PC's USB serial adapter still sends after CTS goes away
+#define HOST_PASTE_SKID	3
+// Keyboard and terminal pairs the backend has
+#define HOST_LINES	4
+// Timer 0 overflow period, the longest hal_idle() can sleep
+#define HOST_TICK_US	HAL_TICK_US
+
+#endif
@@ -0,0 +1,831 @@
+/* hal_linux.cpp, the Linux backend of hal.h
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Everything runs on a virtual microsecond clock.  Time only moves when the
+// converter calls delay(), touches a pin or blocks on a full serial buffer,
+// so a run is deterministic and takes no real time at all.
+//
+// The keyboards are emulated at the pin level, one per converter on the
+// pins its ps2rx_begin() gives: each answers host-to-device frames clocked
+// by ps2cmd.cpp's interrupt handler (with an ACK bit and a reply byte), and
+// sends its own bytes bit by bit on the pins, for ps2rx.cpp or ps2cmd.cpp's
+// handler to read.  Handlers attached with attachInterrupt() run at every
+// falling clock edge, or when interrupts() is called if the edge came while
+// they were off.  Only the primary's keyboard is ever sent commands, and
+// the host_kbd controls are for it; each converter has its own Serial line.
+//
+// A PC on the SoftwareSerial port sends text back to back for as long as the
+// converter holds the CTS pin low, and a few bytes more after it lets go.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "hal_host.h"
+
+HardwareSerial Serial(0), Serial1(1), Serial2(2), Serial3(3);
+
+static uint64_t now_us;
+
+// ---- Pins ----
+
+#define NPINS 70			// As many as a Mega has
+
+static uint8_t pinModes[NPINS];		// All pins start as INPUT
+static uint8_t pinOut[NPINS];
+
+static bool hostLow(uint8_t pin) {
+	return pin < NPINS && pinModes[pin] == OUTPUT && !pinOut[pin];
+}
+
+// ---- Interrupts ----
+
+static bool irqOn = true;
+static uint64_t irqOffAt, irqOffMax;
+static bool inIsr;			// Pin accesses cost no time in a handler
+
+static void (*tickFns[HAL_TICK_FNS])(void);	// hal_tickBegin() handlers
+static unsigned nTickFns;
+static uint64_t nextTick = HOST_TICK_US;
+static bool tickPending;
+
+static void fireTick(void) {
+	unsigned i;
+
+	if (!irqOn) {
+		tickPending = true;
+		return;
+	}
+	inIsr = true;
+	for (i=0; i<nTickFns; i++)
+		tickFns[i]();
+	inIsr = false;
+}
+
+// ---- Keyboards ----
+
+#define KBD_HALFBIT	40		// Half a clock period, about 12.5kHz
+#define KBD_BAT_US	400000UL	// Self test time after a reset
+
+enum { K_IDLE, K_RX, K_TX };
+
+struct KbdByte {
+	uint8_t code;
+	uint64_t at;
+};
+
+struct Kbd {
+	uint8_t clk = NPINS, data = NPINS;	// None until hal_ps2Begin()
+	void (*isr)(void) = NULL;	// Handler on the clock pin
+	bool isrPending = false;	// An edge came with interrupts off
+	int mode = K_IDLE;
+	uint64_t t0 = 0;		// Start of the current frame
+	int edge = 0;			// Next clock edge to process
+	uint16_t rxbits = 0;
+	uint8_t txframe[11];
+	bool rtsHeld = false;		// Host is holding the clock low
+	std::deque<KbdByte> out;	// Bytes waiting to be sent
+	std::deque<KbdByte> reply;	// Answers to commands, which go out first
+	std::deque<KbdByte> fifo;	// In ps2rx.cpp's ring, 'at' is the arrival time
+	uint64_t lastDeliver = 0;
+	uint64_t lastScan = 0;
+	uint8_t lastSent = 0;
+	uint8_t argCmd = 0;		// Command waiting for its argument
+	uint64_t batEnd = 0;		// Busy with its self test until then
+	unsigned naks = 0;		// Answer this many more bytes with 0xFE
+	bool unplugged = false;
+	bool batFails = false;		// Its self test ends with 0xFC
+	unsigned garble = 0, nsent = 0;	// Every garble'th byte gets bad parity
+	bool hasSet3 = false;		// Will switch to scan code set 3
+	uint8_t set = 2;		// Which set the script is in, as far as F0 00 says
+	bool makeOnly[256] = {};	// Set 3 keys whose breaks are left out
+	std::vector<uint8_t> cmds;
+};
+
+static Kbd kbds[HOST_LINES];
+static Kbd &kbd = kbds[0];		// The primary's, the one the controls are for
+
+static void fireClk(Kbd &k) {
+	if (!k.isr)
+		return;
+	if (!irqOn) {
+		k.isrPending = true;
+		return;
+	}
+	inIsr = true;
+	k.isr();
+	inIsr = false;
+}
+
+static void kbdSend(Kbd &k, uint8_t code, uint64_t at) {
+	KbdByte b = { code, at };
+	k.out.push_back(b);
+}
+
+static void kbdReply(Kbd &k, uint8_t code, uint64_t at) {
+	KbdByte b = { code, at };
+	k.reply.push_back(b);
+}
+
+static std::deque<KbdByte> &kbdQueue(Kbd &k) {
+	return k.reply.empty() ? k.out : k.reply;
+}
+
+// Handle a byte from the host, queueing the reply like a real keyboard would
+static void kbdCommand(Kbd &k, uint8_t c, bool parityOk) {
+	uint64_t t = now_us + 500;
+
+	k.cmds.push_back(c);
+	if (now_us < k.batEnd)
+		return;			// Not listening during the self test
+	if (!parityOk || (k.naks && k.naks--)) {
+		kbdReply(k, 0xFE, t);
+		return;
+	}
+	if (k.argCmd && c < 0xED) {
+		if (k.argCmd == 0xF0 && c == 0) {
+			kbdReply(k, 0xFA, t);
+			kbdReply(k, k.set, t);
+		} else {
+			if (k.argCmd == 0xF0 && (c == 2 || (c == 3 && k.hasSet3)))
+				k.set = c;
+			if (k.argCmd == 0xFD)
+				k.makeOnly[c] = true;
+			kbdReply(k, 0xFA, t);
+		}
+		// Set 3 per key commands take a list of keys
+		if (k.argCmd < 0xFB)
+			k.argCmd = 0;
+		return;
+	}
+	k.argCmd = 0;
+	switch (c) {
+		case 0xED:	// Set LEDs
+		case 0xF3:	// Set typematic rate
+		case 0xF0:	// Select scan code set
+		case 0xFB:	// Set 3 keys typematic only,
+		case 0xFC:	// make and break,
+		case 0xFD:	// or make only
+			k.argCmd = c;
+			kbdReply(k, 0xFA, t);
+			break;
+		case 0xEE:	// Echo
+			kbdReply(k, 0xEE, t);
+			break;
+		case 0xF2:	// Read ID
+			kbdReply(k, 0xFA, t);
+			kbdReply(k, 0xAB, t);
+			kbdReply(k, 0x83, t);
+			break;
+		case 0xFE:	// Resend
+			kbdReply(k, k.lastSent, t);
+			break;
+		case 0xF8:	// Set 3, all keys make and break
+			memset(k.makeOnly, 0, sizeof(k.makeOnly));
+			kbdReply(k, 0xFA, t);
+			break;
+		case 0xFF:	// Reset and self test
+			k.out.clear();
+			k.set = 2;
+			memset(k.makeOnly, 0, sizeof(k.makeOnly));
+			kbdReply(k, 0xFA, t);
+			kbdReply(k, k.batFails ? 0xFC : 0xAA, t + KBD_BAT_US);
+			k.batEnd = t + KBD_BAT_US;
+			break;
+		default:
+			kbdReply(k, 0xFA, t);
+			break;
+	}
+}
+
+static bool kbdClockLow(const Kbd &k, uint64_t t) {
+	uint64_t d;
+
+	if (k.mode == K_RX && t >= k.t0) {
+		d = (t - k.t0) / KBD_HALFBIT;
+		return d < 22 && !(d & 1);
+	}
+	if (k.mode == K_TX && t >= k.t0) {
+		d = (t - k.t0) % (2*KBD_HALFBIT);
+		return d >= KBD_HALFBIT/2 && d < KBD_HALFBIT*3/2;
+	}
+	return false;
+}
+
+static bool kbdDataLow(const Kbd &k, uint64_t t) {
+	uint64_t n;
+
+	if (k.mode == K_RX)		// ACK from the rising edge of the stop bit on
+		return k.edge >= 20;
+	if (k.mode == K_TX && t >= k.t0) {
+		n = (t - k.t0) / (2*KBD_HALFBIT);
+		return n < 11 && !k.txframe[n];
+	}
+	return false;
+}
+
+static bool lineHigh(uint8_t pin) {
+	for (auto &k : kbds) {
+		if (pin == k.clk)
+			return !hostLow(pin) && !kbdClockLow(k, now_us);
+		if (pin == k.data)
+			return !hostLow(pin) && !kbdDataLow(k, now_us);
+	}
+	return !hostLow(pin);
+}
+
+// Run a keyboard's side of the wire up to now_us
+static void kbdRun(Kbd &k) {
+	uint64_t t;
+	byte i, parity;
+
+	if (k.mode == K_RX) {
+		while (k.edge < 22 && k.t0 + (uint64_t)k.edge*KBD_HALFBIT <= now_us) {
+			// Odd edges are rising, sample the data line on the first ten
+			if ((k.edge & 1) && k.edge < 20)
+				k.rxbits |= (hostLow(k.data) ? 0 : 1) << (k.edge/2);
+			if (!(k.edge++ & 1))
+				fireClk(k);
+		}
+		if (k.edge == 22) {
+			k.mode = K_IDLE;
+			parity = 0;
+			for (i=0; i<9; i++)
+				parity ^= (k.rxbits >> i) & 1;
+			kbdCommand(k, k.rxbits & 0xFF, parity == 1 && (k.rxbits & 0x200));
+		}
+		return;
+	}
+	if (k.mode == K_TX) {
+		while (k.edge < 11 && k.t0 + (uint64_t)k.edge*2*KBD_HALFBIT + KBD_HALFBIT/2 <= now_us) {
+			k.edge++;
+			fireClk(k);
+		}
+		t = k.t0 + 11*2*KBD_HALFBIT;
+		if (now_us >= t) {
+			k.mode = K_IDLE;
+			k.lastDeliver = t;
+		} else if (k.rtsHeld && now_us < k.t0 + 10*2*KBD_HALFBIT) {
+			// Inhibited before the stop bit, send it again later
+			KbdByte b = { k.lastSent, now_us };
+			k.mode = K_IDLE;
+			k.reply.push_front(b);
+		}
+		return;
+	}
+	while (!kbdQueue(k).empty() && !k.rtsHeld && !k.unplugged) {
+		// Scripted breaks of keys set to make only in set 3 never happen
+		if (k.set == 3 && k.reply.empty() && k.out.size() >= 2
+				&& k.out[0].code == 0xF0 && k.makeOnly[k.out[1].code]) {
+			k.out.pop_front();
+			k.out.pop_front();
+			continue;
+		}
+		KbdByte b = kbdQueue(k).front();
+		t = k.lastDeliver + 1000;
+		if (t < b.at)
+			t = b.at;
+		if (t > now_us || hostLow(k.data))
+			return;
+		kbdQueue(k).pop_front();
+		k.lastSent = b.code;
+		k.mode = K_TX;
+		k.t0 = t;
+		k.edge = 0;
+		parity = 1;
+		k.txframe[0] = 0;
+		for (i=0; i<8; i++) {
+			k.txframe[i+1] = (b.code >> i) & 1;
+			parity ^= k.txframe[i+1];
+		}
+		k.txframe[9] = parity ^ (k.garble && ++k.nsent % k.garble == 0);
+		k.txframe[10] = 1;
+		return;
+	}
+}
+
+// The host changed a pin, see if it's a request to send
+static void kbdHostChanged(void) {
+	for (auto &k : kbds) {
+		if (hostLow(k.clk)) {
+			k.rtsHeld = true;
+			if (!inIsr)
+				kbdRun(k);
+		} else if (k.rtsHeld) {
+			k.rtsHeld = false;
+			if (hostLow(k.data) && k.mode != K_RX && !k.unplugged) {
+				k.mode = K_RX;
+				k.t0 = now_us + 30;
+				k.edge = 0;
+				k.rxbits = 0;
+			}
+		}
+	}
+}
+
+// ---- Serial ----
+
+#define SERIAL_BUFFER	HAL_SERIAL_TX
+
+static struct {
+	std::vector<HostTx> txlog;
+	size_t txwaiting = 0;		// First logged byte the UART hasn't started
+	uint64_t byteTime = 10000000UL / 9600;
+	std::deque<uint8_t> rxq;
+} lines[HOST_LINES];
+
+static void serialRun(void) {
+	unsigned i;
+
+	for (i=0; i<HOST_LINES; i++) {
+		auto &l = lines[i];
+		while (l.txwaiting < l.txlog.size() && l.txlog[l.txwaiting].sent - l.byteTime <= now_us)
+			l.txwaiting++;
+	}
+}
+
+// ---- Paste port ----
+
+#define PASTE_BUFFER	63		// SoftwareSerial's 64 bytes, less one
+
+static struct {
+	uint8_t cts = NPINS;		// None: always clear to send
+	uint64_t byteTime = 10000000UL / 9600;
+	std::deque<uint8_t> out;	// Still at the PC
+	uint64_t next = 0;		// Not before then
+	bool inflight = false;
+	uint8_t c;			// The byte on the wire
+	uint64_t arrive;		// and when its stop bit is in
+	unsigned skid = HOST_PASTE_SKID;
+	std::deque<uint8_t> rx;		// In SoftwareSerial's buffer
+	bool overflow = false;
+	unsigned long lost = 0;
+	std::vector<uint8_t> log;
+} pc;
+
+static bool pasteClear(void) {
+	return pc.cts >= NPINS || hostLow(pc.cts) || pc.skid;
+}
+
+// When the PC next does something, if it can
+static uint64_t pasteNext(void) {
+	if (pc.inflight)
+		return pc.arrive;
+	if (pc.out.empty() || !pasteClear())
+		return UINT64_MAX;
+	return pc.next > now_us ? pc.next : now_us;
+}
+
+static void pasteRun(void) {
+	for (;;) {
+		if (pc.inflight) {
+			if (pc.arrive > now_us)
+				return;
+			pc.inflight = false;
+			// The receive interrupt runs from the start bit to the stop bit
+			if (pc.byteTime > irqOffMax)
+				irqOffMax = pc.byteTime;
+			if (pc.rx.size() < PASTE_BUFFER) {
+				pc.rx.push_back(pc.c);
+			} else {
+				pc.overflow = true;
+				pc.lost++;
+			}
+		}
+		if (pc.out.empty() || pc.next > now_us || !pasteClear())
+			return;
+		if (pc.cts < NPINS && !hostLow(pc.cts))
+			pc.skid--;
+		else
+			pc.skid = HOST_PASTE_SKID;
+		pc.c = pc.out.front();
+		pc.out.pop_front();
+		pc.inflight = true;
+		pc.arrive = now_us + pc.byteTime;
+	}
+}
+
+// ---- Clock ----
+
+static uint64_t sleepTime;
+static unsigned long wakeups;
+
+// When a keyboard next needs to look at the wire
+static uint64_t kbdNext(Kbd &k) {
+	uint64_t t;
+
+	if (k.mode == K_RX)
+		return k.t0 + (uint64_t)k.edge*KBD_HALFBIT;
+	if (k.mode == K_TX && k.edge < 11)
+		return k.t0 + (uint64_t)k.edge*2*KBD_HALFBIT + KBD_HALFBIT/2;
+	if (k.mode == K_TX)
+		return k.t0 + 11*2*KBD_HALFBIT;
+	if (kbdQueue(k).empty() || k.rtsHeld)
+		return UINT64_MAX;
+	t = k.lastDeliver + 1000;
+	if (t < kbdQueue(k).front().at)
+		t = kbdQueue(k).front().at;
+	return t;
+}
+
+void host_advance(uint64_t us) {
+	uint64_t end = now_us + us, t;
+
+	// Stop at every keyboard event so frames start on time, and at every tick
+	while (now_us < end) {
+		t = nextTick;
+		for (auto &k : kbds)
+			if (kbdNext(k) < t)
+				t = kbdNext(k);
+		if (pasteNext() < t)
+			t = pasteNext();
+		now_us = (t > now_us && t < end) ? t : end;
+		for (auto &k : kbds)
+			kbdRun(k);
+		pasteRun();
+		if (now_us >= nextTick) {
+			nextTick += HOST_TICK_US;
+			if (nTickFns)
+				fireTick();
+		}
+	}
+	serialRun();
+}
+
+uint64_t host_now(void) {
+	return now_us;
+}
+
+uint64_t host_maxIrqOff(void) {
+	return irqOffMax;
+}
+
+uint64_t host_sleepTime(void) {
+	return sleepTime;
+}
+
+unsigned long host_wakeups(void) {
+	return wakeups;
+}
+
+// ---- Host controls ----
+
+void host_kbdQueue(uint8_t code, uint64_t at) {
+	kbdSend(kbd, code, at);
+}
+
+void host_kbdQueueOn(uint8_t line, uint8_t code, uint64_t at) {
+	kbdSend(kbds[line % HOST_LINES], code, at);
+}
+
+size_t host_kbdPendingOn(uint8_t line) {
+	Kbd &k = kbds[line % HOST_LINES];
+
+	return k.out.size() + k.reply.size() + k.fifo.size();
+}
+
+void host_kbdNak(unsigned n) {
+	kbd.naks = n;
+}
+
+void host_kbdGarble(unsigned every) {
+	kbd.garble = every;
+	kbd.nsent = 0;
+}
+
+void host_kbdUnplug(bool unplugged) {
+	kbd.unplugged = unplugged;
+}
+
+void host_kbdBatFail(bool fails) {
+	kbd.batFails = fails;
+}
+
+void host_kbdSet3(bool has) {
+	kbd.hasSet3 = has;
+}
+
+size_t host_kbdPending(void) {
+	return host_kbdPendingOn(0);
+}
+
+uint64_t host_kbdLastScan(void) {
+	return kbd.lastScan;
+}
+
+const uint8_t *host_kbdCommands(size_t *n) {
+	*n = kbd.cmds.size();
+	return kbd.cmds.data();
+}
+
+const HostTx *host_serialLog(size_t *n) {
+	return host_serialLogOn(0, n);
+}
+
+const HostTx *host_serialLogOn(uint8_t line, size_t *n) {
+	*n = lines[line].txlog.size();
+	return lines[line].txlog.data();
+}
+
+void host_serialRx(const uint8_t *buf, size_t n) {
+	lines[0].rxq.insert(lines[0].rxq.end(), buf, buf + n);
+}
+
+void host_pasteCts(uint8_t pin) {
+	pc.cts = pin;
+}
+
+void host_pasteQueue(const uint8_t *buf, size_t n, uint64_t at) {
+	pc.out.insert(pc.out.end(), buf, buf + n);
+	pc.next = at;
+}
+
+size_t host_pastePending(void) {
+	return pc.out.size() + pc.inflight + pc.rx.size();
+}
+
+unsigned long host_pasteLost(void) {
+	return pc.lost;
+}
+
+const uint8_t *host_pasteLog(size_t *n) {
+	*n = pc.log.size();
+	return pc.log.data();
+}
+
+// ---- Arduino API ----
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	if (!inIsr)
+		host_advance(HOST_PINIO_US);
+	pinModes[pin % NPINS] = mode;
+	if (mode == INPUT_PULLUP)
+		pinOut[pin % NPINS] = HIGH;
+	kbdHostChanged();
+	pasteRun();
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	if (!inIsr)
+		host_advance(HOST_PINIO_US);
+	pinOut[pin % NPINS] = val ? HIGH : LOW;
+	kbdHostChanged();
+	pasteRun();
+}
+
+int digitalRead(uint8_t pin) {
+	if (!inIsr)
+		host_advance(HOST_PINIO_US);
+	return lineHigh(pin % NPINS) ? HIGH : LOW;
+}
+
+// FastPin<>, a single instruction each on the AVR.  Charging nothing would
+// leave the polling loops in PS2_TVI.cpp spinning on a clock that never
+// moves, so each costs the smallest step we have.
+void hal_fastMode(uint8_t pin, uint8_t mode) {
+	if (!inIsr)
+		host_advance(HOST_FASTIO_US);
+	pinModes[pin % NPINS] = mode;
+	if (mode == INPUT_PULLUP)
+		pinOut[pin % NPINS] = HIGH;
+	kbdHostChanged();
+}
+
+void hal_fastWrite(uint8_t pin, uint8_t val) {
+	if (!inIsr)
+		host_advance(HOST_FASTIO_US);
+	pinOut[pin % NPINS] = val ? HIGH : LOW;
+	kbdHostChanged();
+}
+
+int hal_fastRead(uint8_t pin) {
+	if (!inIsr)
+		host_advance(HOST_FASTIO_US);
+	return lineHigh(pin % NPINS) ? HIGH : LOW;
+}
+
+void delay(unsigned long ms) {
+	host_advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	host_advance(us);
+}
+
+unsigned long millis(void) {
+	return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros(void) {
+	return (unsigned long)now_us;
+}
+
+void hal_stampBegin(void) {
+}
+
+uint16_t hal_stamp(void) {
+	return (uint16_t)(now_us * 1000 / HAL_STAMP_NS);
+}
+
+void noInterrupts(void) {
+	if (irqOn)
+		irqOffAt = now_us;
+	irqOn = false;
+}
+
+void interrupts(void) {
+	if (!irqOn && now_us - irqOffAt > irqOffMax)
+		irqOffMax = now_us - irqOffAt;
+	irqOn = true;
+	for (auto &k : kbds)
+		if (k.isrPending) {
+			k.isrPending = false;
+			fireClk(k);
+		}
+	if (tickPending) {
+		tickPending = false;
+		fireTick();
+	}
+}
+
+void hal_tickBegin(void (*fn)(void)) {
+	if (nTickFns < HAL_TICK_FNS)
+		tickFns[nTickFns++] = fn;
+}
+
+void attachInterrupt(uint8_t num, void (*fn)(void), int mode) {
+	(void)mode;
+	for (auto &k : kbds)
+		if (num == k.clk)
+			k.isr = fn;
+}
+
+void detachInterrupt(uint8_t num) {
+	for (auto &k : kbds)
+		if (num == k.clk)
+			k.isr = NULL;
+}
+
+void hal_clearPendingIrq(byte pin) {
+	for (auto &k : kbds)
+		if (pin == k.clk)
+			k.isrPending = false;
+}
+
+// Sleep until a keyboard finishes a byte or the next timer 0 tick
+void hal_idle(void) {
+	uint64_t wake = (now_us / HOST_TICK_US + 1) * HOST_TICK_US, t;
+
+	for (auto &k : kbds)
+		if (k.isr && (t = kbdNext(k)) < wake && t > now_us)
+			wake = t;
+	// The UART interrupts as each byte moves into its shift register
+	serialRun();
+	for (auto &l : lines)
+		if (l.txwaiting < l.txlog.size() && (t = l.txlog[l.txwaiting].sent - l.byteTime) < wake)
+			wake = t;
+	// and SoftwareSerial's pin change interrupt at each byte
+	if ((t = pasteNext()) < wake && t > now_us)
+		wake = t;
+	sleepTime += wake - now_us;
+	host_advance(wake - now_us);
+	wakeups++;
+	host_advance(HOST_WAKE_US);
+}
+
+void HardwareSerial::begin(unsigned long baud, byte config) {
+	(void)config;
+	lines[line].byteTime = 10000000UL / baud;
+}
+
+int HardwareSerial::available(void) {
+	return lines[line].rxq.size();
+}
+
+int HardwareSerial::read(void) {
+	auto &rxq = lines[line].rxq;
+	int c;
+
+	if (rxq.empty())
+		return -1;
+	c = rxq.front();
+	rxq.pop_front();
+	return c;
+}
+
+int HardwareSerial::availableForWrite(void) {
+	serialRun();
+	return SERIAL_BUFFER - (lines[line].txlog.size() - lines[line].txwaiting);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	auto &l = lines[line];
+	HostTx tx;
+
+	// Block like the Arduino core does when the buffer is full
+	serialRun();
+	while (l.txlog.size() - l.txwaiting >= SERIAL_BUFFER)
+		host_advance(l.txlog[l.txwaiting].sent - l.byteTime - now_us + 1);
+
+	tx.c = c;
+	tx.written = now_us;
+	tx.sent = now_us + l.byteTime;
+	if (!l.txlog.empty() && l.txlog.back().sent + l.byteTime > tx.sent)
+		tx.sent = l.txlog.back().sent + l.byteTime;
+	tx.scan = kbds[line].lastScan;
+	l.txlog.push_back(tx);
+	return 1;
+}
+
+size_t HardwareSerial::write(const char *str) {
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+	size_t i;
+
+	for (i=0; i<len; i++)
+		write(buf[i]);
+	return len;
+}
+
+SoftwareSerial::SoftwareSerial(uint8_t rxPin, uint8_t txPin) {
+	(void)rxPin;
+	(void)txPin;
+}
+
+void SoftwareSerial::begin(long baud) {
+	pc.byteTime = 10000000UL / baud;
+}
+
+int SoftwareSerial::available(void) {
+	pasteRun();
+	return pc.rx.size();
+}
+
+int SoftwareSerial::read(void) {
+	int c;
+
+	pasteRun();
+	if (pc.rx.empty())
+		return -1;
+	c = pc.rx.front();
+	pc.rx.pop_front();
+	return c;
+}
+
+// Bit banged with interrupts off, so the whole byte's time is gone
+size_t SoftwareSerial::write(uint8_t c) {
+	pc.log.push_back(c);
+	host_advance(pc.byteTime);
+	if (pc.byteTime > irqOffMax)
+		irqOffMax = pc.byteTime;
+	return 1;
+}
+
+bool SoftwareSerial::overflow(void) {
+	bool was = pc.overflow;
+
+	pc.overflow = false;
+	return was;
+}
+
+void hal_ps2Begin(byte ch, byte clk, byte data) {
+	kbds[ch % HOST_LINES].clk = clk;
+	kbds[ch % HOST_LINES].data = data;
+}
+
+// The bytes go through ps2rx.cpp's rings; keep their arrival times
+// alongside for the latency figures
+void hal_ps2Put(byte ch) {
+	Kbd &k = kbds[ch % HOST_LINES];
+	KbdByte b = { k.lastSent, now_us };
+
+	k.fifo.push_back(b);
+}
+
+void hal_ps2Taken(byte ch) {
+	Kbd &k = kbds[ch % HOST_LINES];
+
+	if (k.fifo.empty())
+		return;
+	k.lastScan = k.fifo.front().at;
+	k.fifo.pop_front();
+}
@@ -0,0 +1,495 @@
+/* tvi_bench.cpp, runs PS2_TVI.cpp on Linux against a scripted keyboard
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_bench [-n chars] [-r cps] [-t textfile] [-s scanfile] [-o outfile]
+//		[-w rawfile] [-q] [-u] [-d dumpfile] [-3] [-p pastefile] [-c channels]
+//		[-e every] [-b fail|none]
+//
+// Types text (random, or from -t) on the emulated keyboard, or plays raw
+// scan codes from -s (lines of "<time in us> <hex code>"), then reports the
+// per-keystroke CPU cost of loop() and the virtual latency from a scan code
+// arriving to its TVI pair being handed to Serial.  -o writes the TVI output
+// as hex pairs, one per line, so runs can be diffed against each other,
+// and -w everything sent to Serial as is (a trace, with TRACE_CAPTURE).
+// -q sends the stats query afterwards and decodes the answer, see stats.h,
+// and -d asks for the TRACE_RING dump and saves it (tvi_bench_ring).
+// -u has the terminal send a bell, its locks and a few bytes the converter
+// doesn't know, and prints the locks it ends up with and the capture log it
+// sends back, see termrx.h.
+// -3 gives the keyboard scan code set 3, and types text in it, for the
+// converter built with DECODE_SET3 (tvi_bench_set3).  Scan files are sent
+// as they are.
+// -p sends a file to the paste port, as fast as flow control lets it, and
+// types nothing unless there's -s or -t too.  It checks that the text came
+// out as its frames, first, and prints the converter's report with the rate
+// seen on the line (tvi_bench_paste).
+// -c types the same keys at the same times on the first few keyboards, for
+// a build with CHANNELS of them (tvi_bench_multi), and gives the latency
+// each terminal saw.  The totals above are the primary's, or all channels'
+// for the CPU time and awake figures.
+// -e has the keyboard send every n'th byte with bad parity, which the
+// converter drops and counts (see ps2rx.h); -q shows how many.
+// -b fail has the keyboard fail its self test at power on, and -b none
+// leaves it unplugged until the converter has given up on it, then plugs
+// it in.  The boot line gives the outcome and when the converter was ready
+// to type, see boot.h.
+// The awake figure is the share of time the MCU isn't asleep in hal_idle();
+// build with -DLOOP_POLL (tvi_bench_poll) to compare with the old 2ms poll.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "hal_host.h"
+#include "../converter.h"
+#include "../stats.h"
+#include "../trace.h"
+#include "../tvi_xlat.h"
+#include "../paste.h"
+#include "../termrx.h"
+#include "../boot.h"
+#include "../ps2cmd.h"
+
+void setup(void);
+void loop(void);
+
+#define SCAN_ENTER	0x5A
+
+// US layout, unshifted and shifted, with the set 2 make code for each
+static const char keysPlain[] = "`1234567890-=qwertyuiop[]\\asdfghjkl;'zxcvbnm,./ ";
+static const char keysShift[] = "~!@#$%^&*()_+QWERTYUIOP{}|ASDFGHJKL:\"ZXCVBNM<>? ";
+static const uint8_t keysScan[] = {
+	0x0E, 0x16, 0x1E, 0x26, 0x25, 0x2E, 0x36, 0x3D, 0x3E, 0x46, 0x45, 0x4E, 0x55,
+	0x15, 0x1D, 0x24, 0x2D, 0x2C, 0x35, 0x3C, 0x43, 0x44, 0x4D, 0x54, 0x5B, 0x5D,
+	0x1C, 0x1B, 0x23, 0x2B, 0x34, 0x33, 0x3B, 0x42, 0x4B, 0x4C, 0x52,
+	0x1A, 0x22, 0x21, 0x2A, 0x32, 0x31, 0x3A, 0x41, 0x49, 0x4A,
+	0x29,
+};
+
+static uint64_t lastEvent;
+static bool set3;
+static int nchan = 1;
+
+// On every keyboard being typed on
+static void scan(uint8_t code, uint64_t t) {
+	int i;
+
+	for (i=0; i<nchan; i++)
+		host_kbdQueueOn(i, code, t);
+	if (t > lastEvent)
+		lastEvent = t;
+}
+
+static void key(uint8_t code, uint64_t t, bool make) {
+	if (!make)
+		scan(0xF0, t);
+	scan(code, t);
+}
+
+// Anything still to be read or sent, on any channel
+static bool busy(void) {
+	int i;
+
+	for (i=0; i<CHANNELS; i++)
+		if (host_kbdPendingOn(i) || tviq_count(converters[i].txq))
+			return true;
+	return false;
+}
+
+// Queue the make and break codes for one character, returns false if unknown
+static bool typeChar(char c, uint64_t t, uint64_t hold) {
+	const char *p;
+	uint8_t code;
+	bool shift = false;
+
+	if (c == '\n') {
+		code = SCAN_ENTER;
+	} else if (c && (p = strchr(keysPlain, c))) {
+		code = keysScan[p - keysPlain];
+	} else if (c && (p = strchr(keysShift, c))) {
+		code = keysScan[p - keysShift];
+		shift = true;
+	} else {
+		return false;
+	}
+	if (set3 && code == 0x5D)
+		code = 0x5C;			// Backslash, the only one that differs
+	if (shift)
+		key(SCAN_LSHIFT, t, true);
+	key(code, t, true);
+	key(code, t + hold, false);
+	if (shift)
+		key(SCAN_LSHIFT, t + hold, false);
+	return true;
+}
+
+// Decode a stats.h reply
+static bool printStats(const HostTx *log, size_t n) {
+	static const char *counts[NSTATS] = {
+		"parity errors", "unknown keys", "terminal unknown", "command failures", "command resends",
+		"TX dropped", "TX queue high", "RX framing errors", "RX overruns", "boot result",
+		"boot to ready ms"
+	};
+	static const char *stages[NSTAGES] = { "decode", "translate", "enqueue", "TX wait" };
+	unsigned len, i, s, b, w[256];
+	uint8_t sum = 0;
+	double unit;
+
+	if (n < 6 || log[0].c != 'T' || log[1].c != 'V' || log[2].c != 'S'
+			|| log[3].c != STATS_VERSION || (len = log[4].c) + 6 != n || len & 1)
+		return false;
+	for (i=0; i<len; i++)
+		sum += log[5+i].c;
+	if (sum != log[5+len].c)
+		return false;
+	for (i=0; i<len/2; i++)
+		w[i] = log[5+2*i].c | log[6+2*i].c << 8;
+
+	for (i=0; i<NSTATS; i++)
+		printf("%-18s%u\n", counts[i], w[i]);
+	for (s=0; s<NSTAGES; s++) {
+		unit = s == ST_WAIT ? 1 << STATS_WAIT_SHIFT : HAL_STAMP_NS / 1000.0;
+		i = NSTATS + s * (1 + STATS_BUCKETS);
+		printf("%-18smax %.1f us,", stages[s], w[i] * unit);
+		for (b=0; b<STATS_BUCKETS; b++) {
+			if (!w[i+1+b])
+				continue;
+			if (b == STATS_BUCKETS-1)
+				printf(" >=%g:%u", (1 << (b-1)) * unit, w[i+1+b]);
+			else
+				printf(" <%g:%u", (1 << b) * unit, w[i+1+b]);
+		}
+		printf("\n");
+	}
+	return true;
+}
+
+// The reply to TERMRX_DUMP
+static bool printCapture(const HostTx *log, size_t n) {
+	unsigned i;
+
+	if (n < 5 || log[0].c != 'T' || log[1].c != 'V' || log[2].c != 'U'
+			|| log[3].c != TERMRX_VERSION || log[4].c + 5u != n)
+		return false;
+	printf("captured          %u:", log[4].c);
+	for (i=5; i<n; i++)
+		printf(" %02X", log[i].c);
+	printf("\n");
+	return true;
+}
+
+// Compare what came out with the frames the pasted text should give
+static void checkPaste(const std::vector<uint8_t> &text, const HostTx *log, size_t nlog) {
+	size_t i, n = 0;
+	uint8_t last = 0;
+	uint16_t f;
+	const uint8_t *reply;
+	size_t nreply;
+
+	for (i=0; i<text.size(); i++) {
+		if (text[i] >= 0x80 || (text[i] == '\n' && last == '\r')) {
+			last = text[i];
+			continue;
+		}
+		last = text[i];
+		f = xlat_ascii[text[i]];
+		if (2*n+1 >= nlog || log[2*n].c != f >> 8 || log[2*n+1].c != (f & 0xFF)) {
+			printf("paste differs at character %zu of %zu\n", i, text.size());
+			return;
+		}
+		n++;
+	}
+	printf("paste characters  %zu", n);
+	if (n > 1)
+		printf(", %.1f cps on the line", (n - 1) * 1e6 / (log[2*n-1].sent - log[1].sent));
+	printf(", %lu overrun\n", host_pasteLost());
+	reply = host_pasteLog(&nreply);
+	printf("paste report     ");
+	for (i=0; i<nreply; i++)
+		if (reply[i] >= ' ')
+			putchar(reply[i]);
+	printf("\n");
+}
+
+// Latency on one of the other terminals, and whether it got what the first did
+static void printChannel(int line, const HostTx *first, size_t nfirst) {
+	const HostTx *log;
+	size_t n, i;
+	uint64_t lat, latMax = 0, latSum = 0;
+	bool same;
+
+	log = host_serialLogOn(line, &n);
+	for (i=1; i<n; i+=2) {
+		lat = log[i].written - log[i].scan;
+		latSum += lat;
+		if (lat > latMax)
+			latMax = lat;
+	}
+	same = n == nfirst;
+	for (i=0; same && i<n; i++)
+		same = log[i].c == first[i].c;
+	printf("channel %d         mean %.1f us, max %llu us, %s\n", line,
+		n > 1 ? (double)latSum / (n / 2) : 0.0, (unsigned long long)latMax,
+		same ? "same output" : "output differs");
+}
+
+static double nowSec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	long nchars = 1000, cps = 15, i;
+	const char *textFile = NULL, *scanFile = NULL, *outFile = NULL, *rawFile = NULL;
+	const char *dumpFile = NULL, *pasteFile = NULL, *bootAs = "";
+	static const char *boots[] = { "waiting", "passed", "failed", "no keyboard" };
+	byte bootResult;
+	unsigned bootMs;
+	std::vector<uint8_t> pasted;
+	uint64_t t, period, lat, latMax = 0, latSum = 0, npairs;
+	uint64_t start, slept;
+	unsigned long woke;
+	size_t nlog, nscan = 0, ncmd;
+	const HostTx *log;
+	unsigned seed = 1, r;
+	const char *keys;
+	double wall;
+	bool query = false, termrx = false;
+	int opt;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "n:r:t:s:o:w:qud:3p:c:e:b:")) != -1) {
+		switch (opt) {
+			case 'n': nchars = atol(optarg); break;
+			case 'r': cps = atol(optarg); break;
+			case 't': textFile = optarg; break;
+			case 's': scanFile = optarg; break;
+			case 'o': outFile = optarg; break;
+			case 'w': rawFile = optarg; break;
+			case 'q': query = true; break;
+			case 'u': termrx = true; break;
+			case 'd': dumpFile = optarg; break;
+			case '3': set3 = true; break;
+			case 'p': pasteFile = optarg; break;
+			case 'c': nchan = atoi(optarg); break;
+			case 'e': host_kbdGarble(atoi(optarg)); break;
+			case 'b': bootAs = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-n chars] [-r cps] [-t textfile] "
+					"[-s scanfile] [-o outfile] [-w rawfile] [-q] [-u] [-d dumpfile] [-3] [-p pastefile] "
+					"[-c channels] [-e every] [-b fail|none]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (*bootAs && strcmp(bootAs, "fail") && strcmp(bootAs, "none")) {
+		fprintf(stderr, "%s: -b fail or -b none\n", argv[0]);
+		return 2;
+	}
+	if (nchan < 1 || nchan > CHANNELS) {
+		fprintf(stderr, "%s: built for %d channels\n", argv[0], CHANNELS);
+		return 2;
+	}
+
+	// Let the reset in setup() and the keyboard's self test finish first
+	host_kbdSet3(set3);
+	host_kbdBatFail(!strcmp(bootAs, "fail"));
+	host_kbdUnplug(!strcmp(bootAs, "none"));
+	host_pasteCts(PASTE_CTS_PIN);
+	setup();
+	while (host_now() < 1000000 || !boot_ms)
+		loop();
+	bootResult = boot_result;
+	bootMs = boot_ms;
+	if (!strcmp(bootAs, "none")) {
+		// Plugged in now, and set up when it says so
+		host_kbdUnplug(false);
+		host_kbdQueue(PS2_BAT_OK, host_now() + 1000);
+		for (t = host_now() + 100000; host_now() < t; )
+			loop();
+	}
+
+	t = host_now() + 10000;
+	period = 1000000 / (cps > 0 ? cps : 1);
+	if (pasteFile) {
+		int c;
+
+		if (!(f = fopen(pasteFile, "rb"))) {
+			perror(pasteFile);
+			return 1;
+		}
+		while ((c = fgetc(f)) != EOF)
+			pasted.push_back(c);
+		fclose(f);
+		host_pasteQueue(pasted.data(), pasted.size(), t);
+	}
+	if (scanFile) {
+		unsigned long long at;
+		unsigned code;
+
+		if (!(f = fopen(scanFile, "r"))) {
+			perror(scanFile);
+			return 1;
+		}
+		while (fscanf(f, "%llu %x", &at, &code) == 2) {
+			scan(code, t + at);
+			nscan++;
+		}
+		fclose(f);
+	} else if (textFile) {
+		int c;
+
+		if (!(f = fopen(textFile, "r"))) {
+			perror(textFile);
+			return 1;
+		}
+		while ((c = fgetc(f)) != EOF)
+			if (typeChar(c, t, period/2))
+				t += period;
+		fclose(f);
+	} else if (!pasteFile) {
+		for (i=0; i<nchars; i++) {
+			// Mostly lower case, a quarter shifted
+			seed = seed * 1103515245 + 12345;
+			r = seed >> 16;
+			keys = (r & 3) ? keysPlain : keysShift;
+			typeChar(keys[(r >> 2) % (sizeof(keysPlain)-1)], t, period/2);
+			t += period;
+		}
+	}
+	if (!nscan)
+		nscan = host_kbdPending();
+
+	start = host_now();
+	slept = host_sleepTime();
+	woke = host_wakeups();
+	wall = nowSec();
+	while (busy() || host_now() < lastEvent + 100000)
+		loop();
+	if (pasteFile) {
+		while (host_pastePending() || tviq_count(converters[0].txq))
+			loop();
+		for (t = host_now() + PASTE_IDLE_MS * 1000UL + 100000; host_now() < t; )
+			loop();
+	}
+	wall = nowSec() - wall;
+	slept = host_sleepTime() - slept;
+	woke = host_wakeups() - woke;
+
+	log = host_serialLog(&nlog);
+	npairs = nlog / 2;
+	for (i=1; i<(long)nlog; i+=2) {
+		lat = log[i].written - log[i].scan;
+		latSum += lat;
+		if (lat > latMax)
+			latMax = lat;
+	}
+	host_kbdCommands(&ncmd);
+
+	printf("scan codes        %zu\n", nscan);
+	printf("TVI pairs         %llu\n", (unsigned long long)npairs);
+	printf("keyboard commands %zu\n", ncmd);
+	printf("boot              %s, ready at %u ms\n", boots[bootResult], bootMs);
+	printf("CPU per scan code %.1f ns\n", wall * 1e9 / (nscan ? nscan : 1));
+	printf("latency mean      %.1f us\n", npairs ? (double)latSum / npairs : 0.0);
+	printf("latency max       %llu us\n", (unsigned long long)latMax);
+	printf("irq off max       %llu us\n", (unsigned long long)host_maxIrqOff());
+	printf("awake             %.2f %%\n", 100.0 * (host_now() - start - slept) / (host_now() - start));
+	printf("wakeups per sec   %.1f\n", woke * 1e6 / (host_now() - start));
+	printf("TX queue high     %u of %u\n", tviq_highWater, TVIQ_SIZE);
+	printf("TX merged/dropped %u/%u\n", tviq_merges, tviq_drops);
+	for (i=1; i<nchan; i++)
+		printChannel(i, log, nlog);
+	if (pasteFile)
+		checkPaste(pasted, log, nlog);
+
+	if (query) {
+		static const uint8_t ask[] = { 0x1B, 0x1F, STATS_QUERY };
+		size_t before = nlog, n;
+
+		host_serialRx(ask, sizeof(ask));
+		for (t = host_now() + 500000; host_now() < t; )
+			loop();
+		log = host_serialLog(&n);
+		if (!printStats(log + before, n - before))
+			printf("no stats reply\n");
+	}
+	if (termrx) {
+		static const uint8_t talk[] = { 0x07, 0x1B, 0x1F, TERMRX_LOCKS, TERMRX_ALOCK,
+			0x11, 'x', 0x1B, 'Q', 0x1B, 0x1F, '?', 0x13 };
+		static const uint8_t ask[] = { 0x1B, 0x1F, TERMRX_DUMP };
+		size_t before, n;
+
+		host_serialRx(talk, sizeof(talk));
+		for (t = host_now() + 100000; host_now() < t; )
+			loop();
+		printf("locks             %s%s\n",
+			converters[0].modifier & MOD_CLOCK ? "alpha " : "",
+			converters[0].modifier & MOD_NLOCK ? "num" : "");
+		host_serialLog(&before);
+		host_serialRx(ask, sizeof(ask));
+		for (t = host_now() + 100000; host_now() < t; )
+			loop();
+		log = host_serialLog(&n);
+		if (!printCapture(log + before, n - before))
+			printf("no capture log\n");
+	}
+	if (dumpFile) {
+		static const uint8_t ask[] = { 0x1B, 0x1F, TRACE_DUMP };
+		size_t before, n;
+
+		host_serialLog(&before);
+		host_serialRx(ask, sizeof(ask));
+		for (t = host_now() + 500000; host_now() < t; )
+			loop();
+		log = host_serialLog(&n);
+		if (!(f = fopen(dumpFile, "wb"))) {
+			perror(dumpFile);
+			return 1;
+		}
+		for (; before < n; before++)
+			fputc(log[before].c, f);
+		fclose(f);
+	}
+
+	if (outFile) {
+		if (!(f = fopen(outFile, "w"))) {
+			perror(outFile);
+			return 1;
+		}
+		for (i=0; i+1<(long)nlog; i+=2)
+			fprintf(f, "%02X %02X\n", log[i].c, log[i+1].c);
+		if (nlog & 1)
+			fprintf(f, "%02X\n", log[nlog-1].c);
+		fclose(f);
+	}
+	if (rawFile) {
+		if (!(f = fopen(rawFile, "wb"))) {
+			perror(rawFile);
+			return 1;
+		}
+		for (i=0; i<(long)nlog; i++)
+			fputc(log[i].c, f);
+		fclose(f);
+	}
+	return 0;
+}
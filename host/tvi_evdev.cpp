@@ -0,0 +1,350 @@
+/* tvi_evdev.cpp, a Linux keyboard on a TeleVideo terminal, no Arduino
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_evdev [-g] [-b baud] [-v] -o tty device...
+//
+// Reads keys from /dev/input/event* devices (or pipes of input events, see
+// tvi_evdev_test), turns each into the set 2 scan codes a PS/2 keyboard
+// would send (evdev.cpp) and those into TVI frames with the converter's own
+// tables (tvi_translate.h), and writes them to the terminal on tty, raw at
+// baud (HOSTBAUD by default).  All the devices together are one keyboard,
+// and when one goes away the keys it had down are taken as let go.
+// -g grabs the devices so the console doesn't see the keys too.
+//
+// The kernel's autorepeat resends the key's last frame, while nothing else
+// has changed, much as typematic.cpp does.  The lock keys set the LEDs.
+//
+// One epoll loop waits on the devices, the tty (for writing, only when a
+// frame didn't fit) and the signals.  SIGUSR1 prints the latency from each
+// event's timestamp to its frame being written to the tty, and so does
+// SIGINT or SIGTERM on the way out, or -v after every key.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "evdev.h"
+#include "tvi_translate.h"
+
+#define NBUCKETS	24		// Latency histogram, powers of two in us
+#define MAXEVENTS	16
+
+struct Pending {
+	byte b;
+	bool last;			// Of its frame
+	uint64_t us;			// Of the key event
+};
+
+struct Dev {
+	int fd;
+	std::vector<uint8_t> down;	// Keys it has down, in keys.h's terms
+};
+
+static struct {
+	int tty, ep;
+	std::vector<Dev> devs;
+	std::deque<Pending> out;
+	bool writable = true;		// Last write took everything
+	TviTranslator tr;
+	byte leds;
+	byte repeatKey, repeatMods;
+	uint16_t repeatFrame;
+	unsigned long frames, lat[NBUCKETS];
+	uint64_t latSum, latMax;
+	bool verbose;
+} b;
+
+static uint64_t nowUs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int bucket(uint64_t us) {
+	int i = 0;
+
+	while (us > 1 && i < NBUCKETS-1) {
+		us >>= 1;
+		i++;
+	}
+	return i;
+}
+
+static void report(void) {
+	int i;
+
+	fprintf(stderr, "frames            %lu\n", b.frames);
+	if (!b.frames)
+		return;
+	fprintf(stderr, "latency           %.0f us average, %llu us worst\n",
+		(double)b.latSum / b.frames, (unsigned long long)b.latMax);
+	for (i=0; i<NBUCKETS; i++)
+		if (b.lat[i])
+			fprintf(stderr, "  < %8u us     %lu\n", 2u << i, b.lat[i]);
+}
+
+static void watchTty(bool out) {
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | (out ? (uint32_t)EPOLLOUT : 0);
+	ev.data.fd = b.tty;
+	epoll_ctl(b.ep, EPOLL_CTL_MOD, b.tty, &ev);
+}
+
+// Write as much as the tty takes, and time the frames that are done
+static void flush(void) {
+	byte buf[256];
+	size_t n;
+	ssize_t w;
+	uint64_t now, l;
+
+	while (!b.out.empty()) {
+		for (n=0; n<sizeof(buf) && n<b.out.size(); n++)
+			buf[n] = b.out[n].b;
+		w = write(b.tty, buf, n);
+		if (w <= 0)
+			break;
+		now = nowUs();
+		for (; w; w--) {
+			if (b.out.front().last) {
+				l = now > b.out.front().us ? now - b.out.front().us : 0;
+				b.frames++;
+				b.lat[bucket(l)]++;
+				b.latSum += l;
+				if (l > b.latMax)
+					b.latMax = l;
+			}
+			b.out.pop_front();
+		}
+	}
+	if (b.out.empty() != b.writable) {
+		b.writable = b.out.empty();
+		watchTty(!b.writable);
+	}
+}
+
+static void queue(uint16_t f, uint64_t us) {
+	b.out.push_back(Pending{ (byte)(f >> 8), false, us });
+	b.out.push_back(Pending{ (byte)(f & 0xFF), true, us });
+}
+
+static void key(const EvdevKey &k) {
+	byte scan[EVDEV_MAXSCAN], frames[2 * EVDEV_MAXSCAN];
+	size_t n, i;
+
+	if (k.value == 2) {
+		// The kernel's repeat, but we know better what it should send
+		if (k.key == b.repeatKey && b.tr.modifier == b.repeatMods)
+			queue(b.repeatFrame, k.us);
+		return;
+	}
+	n = evdev_scancodes(k.key, k.value, scan);
+	n = tvi_translate(b.tr, scan, n, frames);
+	for (i=0; i<n; i+=2)
+		queue(frames[i] << 8 | frames[i+1], k.us);
+	if (k.value && n && k.key != EVDEV_PAUSE) {
+		b.repeatKey = k.key;
+		b.repeatMods = b.tr.modifier;
+		b.repeatFrame = frames[n-2] << 8 | frames[n-1];
+	} else if (k.value || k.key == b.repeatKey) {
+		b.repeatKey = 0;
+	}
+
+	if ((b.leds ^ b.tr.modifier) & (MOD_CLOCK|MOD_NLOCK)) {
+		b.leds = b.tr.modifier;
+		for (const Dev &d : b.devs)
+			evdev_leds(d.fd, b.leds & MOD_CLOCK, b.leds & MOD_NLOCK);
+	}
+}
+
+// Keep track of what each device holds, Pause has no break to wait for
+static void track(Dev &d, const EvdevKey &k) {
+	auto i = std::find(d.down.begin(), d.down.end(), k.key);
+
+	if (k.value == 1 && i == d.down.end() && k.key != EVDEV_PAUSE)
+		d.down.push_back(k.key);
+	else if (!k.value && i != d.down.end())
+		d.down.erase(i);
+}
+
+// Its breaks will never come, so send them for the keys it had down that
+// no other device holds too, which stops the repeat if it was one of them
+static void unplug(std::vector<Dev>::iterator d) {
+	std::vector<uint8_t> down = d->down;
+
+	epoll_ctl(b.ep, EPOLL_CTL_DEL, d->fd, NULL);
+	close(d->fd);
+	b.devs.erase(d);
+	for (uint8_t k : down) {
+		bool held = false;
+		for (const Dev &o : b.devs)
+			if (std::find(o.down.begin(), o.down.end(), k) != o.down.end())
+				held = true;
+		if (!held)
+			key(EvdevKey{ k, 0, nowUs() });
+	}
+	flush();
+}
+
+static speed_t baudRate(long baud) {
+	switch (baud) {
+		case 1200:	return B1200;
+		case 2400:	return B2400;
+		case 4800:	return B4800;
+		case 9600:	return B9600;
+		case 19200:	return B19200;
+		case 38400:	return B38400;
+		case 57600:	return B57600;
+		case 115200:	return B115200;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *ttyPath = NULL;
+	long baud = HOSTBAUD;
+	bool grab = false, done = false, hungUp = false;
+	int opt, i, n, fd, r;
+	struct termios tio;
+	struct epoll_event ev, evs[MAXEVENTS];
+	struct signalfd_siginfo si;
+	sigset_t sigs;
+	int sfd;
+	EvdevKey k;
+	byte junk[64];
+
+	while ((opt = getopt(argc, argv, "gb:vo:")) != -1) {
+		switch (opt) {
+			case 'g': grab = true; break;
+			case 'b': baud = atol(optarg); break;
+			case 'v': b.verbose = true; break;
+			case 'o': ttyPath = optarg; break;
+			default:
+				ttyPath = NULL;
+				optind = argc;
+				break;
+		}
+	}
+	if (!ttyPath || optind == argc || !baudRate(baud)) {
+		fprintf(stderr, "usage: %s [-g] [-b baud] [-v] -o tty device...\n", argv[0]);
+		return 2;
+	}
+
+	b.tty = open(ttyPath, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (b.tty < 0 || tcgetattr(b.tty, &tio) < 0) {
+		perror(ttyPath);
+		return 1;
+	}
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	cfsetispeed(&tio, baudRate(baud));
+	cfsetospeed(&tio, baudRate(baud));
+	if (tcsetattr(b.tty, TCSANOW, &tio) < 0) {
+		perror(ttyPath);
+		return 1;
+	}
+
+	b.ep = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.fd = b.tty;
+	epoll_ctl(b.ep, EPOLL_CTL_ADD, b.tty, &ev);
+	for (i=optind; i<argc; i++) {
+		if ((fd = evdev_open(argv[i], grab)) < 0) {
+			perror(argv[i]);
+			return 1;
+		}
+		ev.data.fd = fd;
+		epoll_ctl(b.ep, EPOLL_CTL_ADD, fd, &ev);
+		b.devs.push_back(Dev{ fd, {} });
+	}
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+	sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+	ev.data.fd = sfd;
+	epoll_ctl(b.ep, EPOLL_CTL_ADD, sfd, &ev);
+
+	tvi_translate_begin(b.tr);
+	b.leds = b.tr.modifier;
+	for (const Dev &d : b.devs)
+		evdev_leds(d.fd, b.leds & MOD_CLOCK, b.leds & MOD_NLOCK);
+
+	while (!done && !hungUp && !b.devs.empty()) {
+		n = epoll_wait(b.ep, evs, MAXEVENTS, -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			return 1;
+		}
+		for (i=0; i<n; i++) {
+			fd = evs[i].data.fd;
+			if (fd == sfd) {
+				while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+					if (si.ssi_signo == SIGUSR1)
+						report();
+					else
+						done = true;
+				}
+			} else if (fd == b.tty) {
+				// The terminal's own ESC US commands are the board's
+				// business, not ours
+				while (read(b.tty, junk, sizeof(junk)) > 0)
+					;
+				if (evs[i].events & (EPOLLHUP|EPOLLERR)) {
+					fprintf(stderr, "tvi_evdev: %s hung up\n", ttyPath);
+					hungUp = true;
+					break;
+				}
+			} else {
+				auto d = std::find_if(b.devs.begin(), b.devs.end(),
+					[fd](const Dev &x) { return x.fd == fd; });
+				if (d == b.devs.end())
+					continue;
+				while ((r = evdev_read(fd, &k)) > 0) {
+					track(*d, k);
+					key(k);
+					flush();
+					if (b.verbose)
+						report();
+				}
+				if (r < 0) {
+					fprintf(stderr, "tvi_evdev: a device went away\n");
+					unplug(d);
+				}
+			}
+			if (evs[i].events & EPOLLOUT)
+				flush();
+		}
+	}
+	report();
+	return done ? 0 : 1;
+}
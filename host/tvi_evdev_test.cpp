@@ -0,0 +1,291 @@
+/* tvi_evdev_test.cpp, tvi_evdev end to end through a pipe and a pty
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_evdev_test [-d daemon] [-r rounds]
+//
+// Starts tvi_evdev (./tvi_evdev unless -d) on the slave side of a pty,
+// reading two pipes instead of keyboards, and types the keys below into the
+// first as input events stamped with CLOCK_MONOTONIC, a few ms apart.  What
+// comes out of the pty's master side has to be what tvi_translate() makes
+// of the same keys as scan codes, with the kernel's repeats as the last
+// frame again, and some frames are checked by value as well.  Then keys
+// are held on both and the second pipe is closed, which must let go of its
+// keys only.  Prints the latency from each event's timestamp to its frame
+// being read back, then the daemon's own figures, and exits 1 on any
+// difference.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "evdev.h"
+#include "tvi_translate.h"
+
+#define GAP_US		2000		// Between events
+#define WAIT_MS		1000		// For a frame to come back
+
+#define NOFRAME		0xFFFF		// Step.expect: nothing comes back
+#define GONE		3		// Step.value: close the pipe
+
+struct Step {
+	byte key, value;
+	uint16_t expect;		// Checked by value if not 0
+};
+
+// Keys are numbered as in keys.h
+static const Step steps[] = {
+	{ 0x33, 1, 0x0068 }, { 0x33, 0, 0 },			// h e l l o
+	{ 0x24, 1, 0 }, { 0x24, 0, 0 }, { 0x4B, 1, 0 }, { 0x4B, 0, 0 },
+	{ 0x4B, 1, 0 }, { 0x4B, 0, 0 }, { 0x44, 1, 0 }, { 0x44, 0, 0 },
+	{ SCAN_LSHIFT, 1, 0 }, { 0x1C, 1, 0x2041 }, { 0x1C, 0, 0 },	// A
+	{ SCAN_LSHIFT, 0, 0 },
+	{ SCAN_CLOCK, 1, 0 }, { SCAN_CLOCK, 0, 0 }, { 0x1C, 1, 0 },	// Alpha lock a
+	{ 0x1C, 0, 0 }, { SCAN_CLOCK, 1, 0 }, { SCAN_CLOCK, 0, 0 },
+	{ SCAN_NLOCK, 1, 0 }, { SCAN_NLOCK, 0, 0 }, { 0x6C, 1, 0 },	// Keypad 7 as Home
+	{ 0x6C, 0, 0 }, { SCAN_NLOCK, 1, 0 }, { SCAN_NLOCK, 0, 0 },
+	{ 0x6C, 1, 0 }, { 0x6C, 0, 0 },
+	{ EXT_E0 | SCAN_E0_UP, 1, 0 }, { EXT_E0 | SCAN_E0_UP, 0, 0 },
+	{ EXT_E0 | SCAN_E0_DEL, 1, 0 }, { EXT_E0 | SCAN_E0_DEL, 0, 0 },
+	{ EXT_E0 | SCAN_E0_KPENT, 1, 0 }, { EXT_E0 | SCAN_E0_KPENT, 0, 0 },
+	{ EXT_E0 | SCAN_E0_KPSL, 1, 0 }, { EXT_E0 | SCAN_E0_KPSL, 0, 0 },
+	{ SCAN_CTRL, 1, 0 }, { 0x21, 1, 0 }, { 0x21, 0, 0 }, { SCAN_CTRL, 0, 0 },		// ^C
+	{ EXT_E0 | SCAN_ALT, 1, 0 }, { 0x05, 1, 0 }, { 0x05, 0, 0 },			// FUNCT F1
+	{ EXT_E0 | SCAN_ALT, 0, 0 },
+	{ 0x83, 1, 0 }, { 0x83, 0, 0 },						// F7
+	{ 0x29, 1, 0x0020 }, { 0x29, 2, 0x0020 }, { 0x29, 2, 0x0020 },		// Held space
+	{ 0x29, 2, 0x0020 }, { 0x29, 0, NOFRAME },
+	{ 0x29, 1, 0x0020 }, { SCAN_LSHIFT, 1, NOFRAME },			// Repeat stops
+	{ 0x29, 2, NOFRAME }, { 0x29, 0, NOFRAME }, { SCAN_LSHIFT, 0, NOFRAME },
+	{ EVDEV_PAUSE, 1, 0 }, { EVDEV_PAUSE, 2, NOFRAME }, { EVDEV_PAUSE, 0, NOFRAME },
+};
+
+// Once, after the rounds: shift held on the first device, control and A on
+// the second, which goes away.  Shift stays down, while control is up and
+// the A no longer repeats.
+static const struct {
+	byte pipe;
+	Step s;
+} unplug[] = {
+	{ 0, { SCAN_LSHIFT, 1, NOFRAME } }, { 1, { SCAN_CTRL, 1, NOFRAME } },
+	{ 1, { 0x1C, 1, 0x6001 } }, { 1, { 0, GONE, NOFRAME } },
+	{ 0, { 0x1C, 2, NOFRAME } }, { 0, { 0x24, 1, 0x2045 } }, { 0, { 0x24, 0, NOFRAME } },
+	{ 0, { SCAN_LSHIFT, 0, NOFRAME } }, { 0, { 0x24, 1, 0x0065 } }, { 0, { 0x24, 0, NOFRAME } },
+};
+
+static uint64_t nowUs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// What the daemon should send for a step, the same way it gets there
+static size_t expected(TviTranslator &t, const Step &s, byte *out) {
+	static byte repeatKey, repeatMods;
+	static uint16_t repeatFrame;
+	byte scan[EVDEV_MAXSCAN];
+	size_t n;
+
+	if (s.value == 2) {
+		if (s.key != repeatKey || t.modifier != repeatMods)
+			return 0;
+		out[0] = repeatFrame >> 8;
+		out[1] = repeatFrame & 0xFF;
+		return 2;
+	}
+	n = tvi_translate(t, scan, evdev_scancodes(s.key, s.value, scan), out);
+	if (s.value && n && s.key != EVDEV_PAUSE) {
+		repeatKey = s.key;
+		repeatMods = t.modifier;
+		repeatFrame = out[n-2] << 8 | out[n-1];
+	} else if (s.value || s.key == repeatKey) {
+		repeatKey = 0;
+	}
+	return n;
+}
+
+// Read n bytes from the pty within WAIT_MS
+static bool readBack(int fd, byte *buf, size_t n) {
+	struct pollfd p = { fd, POLLIN, 0 };
+	ssize_t r;
+
+	while (n) {
+		if (poll(&p, 1, WAIT_MS) <= 0)
+			return false;
+		r = read(fd, buf, n);
+		if (r <= 0)
+			return false;
+		buf += r;
+		n -= r;
+	}
+	return true;
+}
+
+static const char *how(const Step &s) {
+	switch (s.value) {
+		case 0:		return "up";
+		case 1:		return "down";
+		case 2:		return "repeat";
+	}
+	return "gone";
+}
+
+static int master, pipes[2];
+static size_t frames;
+static uint64_t latSum, latMax;
+
+// Type one step on pipe p and check that n bytes of want, and nothing else
+// before them, come back
+static bool step(long r, int p, const Step &s, const byte *want, size_t n) {
+	byte got[2 * EVDEV_MAXSCAN];
+	uint64_t at, lat;
+	size_t i;
+
+	at = nowUs();
+	if (s.value == GONE) {
+		close(pipes[p]);
+		pipes[p] = -1;
+		usleep(100000);		// No frame to wait on, give it time
+		return true;
+	}
+	if (!evdev_write(pipes[p], s.key, s.value, at)) {
+		perror("write");
+		return false;
+	}
+	if (s.expect == NOFRAME && n) {
+		printf("round %ld: key %02X %s should send nothing\n", r, s.key, how(s));
+		return false;
+	}
+	if (n && !readBack(master, got, n)) {
+		printf("round %ld: key %02X %s: nothing back\n", r, s.key, how(s));
+		return false;
+	}
+	lat = nowUs() - at;
+	if (memcmp(got, want, n) || (s.expect && s.expect != NOFRAME
+			&& (n < 2 || (got[0] << 8 | got[1]) != s.expect))) {
+		printf("round %ld: key %02X %s sent", r, s.key, how(s));
+		for (i=0; i<n; i++)
+			printf(" %02X", got[i]);
+		printf(", expected");
+		for (i=0; i<n; i++)
+			printf(" %02X", want[i]);
+		if (s.expect && s.expect != NOFRAME)
+			printf(" (%04X)", s.expect);
+		printf("\n");
+		return false;
+	}
+	if (n) {
+		frames += n / 2;
+		latSum += lat;
+		if (lat > latMax)
+			latMax = lat;
+	}
+	usleep(GAP_US);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	const char *daemon = "./tvi_evdev";
+	long rounds = 10, r;
+	int opt, pfd[2][2], status, failed = 0;
+	char slave[64], dev[2][32];
+	pid_t pid;
+	TviTranslator t;
+	byte want[2 * EVDEV_MAXSCAN], extra;
+	size_t n;
+
+	while ((opt = getopt(argc, argv, "d:r:")) != -1) {
+		switch (opt) {
+			case 'd': daemon = optarg; break;
+			case 'r': rounds = atol(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d daemon] [-r rounds]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) < 0
+			|| unlockpt(master) < 0 || ptsname_r(master, slave, sizeof(slave))) {
+		perror("pty");
+		return 1;
+	}
+	for (int p=0; p<2; p++) {
+		if (pipe(pfd[p]) < 0) {
+			perror("pipe");
+			return 1;
+		}
+		snprintf(dev[p], sizeof(dev[p]), "/dev/fd/%d", pfd[p][0]);
+	}
+	if ((pid = fork()) == 0) {
+		close(pfd[0][1]);
+		close(pfd[1][1]);
+		close(master);
+		execl(daemon, daemon, "-o", slave, dev[0], dev[1], (char *)NULL);
+		perror(daemon);
+		_exit(127);
+	}
+	for (int p=0; p<2; p++) {
+		close(pfd[p][0]);
+		pipes[p] = pfd[p][1];
+	}
+	usleep(100000);			// For it to set the pty raw
+
+	tvi_translate_begin(t);
+	for (r=0; r<rounds && !failed; r++)
+		for (const Step &s : steps)
+			if (!step(r, 0, s, want, expected(t, s, want))) {
+				failed++;
+				break;
+			}
+	for (const auto &u : unplug) {
+		if (failed)
+			break;
+		n = 0;
+		if (u.s.expect != NOFRAME) {
+			want[n++] = u.s.expect >> 8;
+			want[n++] = u.s.expect & 0xFF;
+		}
+		if (!step(r, u.pipe, u.s, want, n))
+			failed++;
+	}
+	// and nothing more than that
+	if (!failed && readBack(master, &extra, 1)) {
+		printf("extra byte %02X\n", extra);
+		failed++;
+	}
+
+	printf("frames            %zu in %ld rounds, %s\n", frames, r, failed ? "FAILED" : "all as expected");
+	if (frames)
+		printf("event to pty      %.0f us average, %llu us worst\n",
+			(double)latSum / frames, (unsigned long long)latMax);
+	printf("== tvi_evdev\n");
+	fflush(stdout);
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+	for (int p=0; p<2; p++)
+		if (pipes[p] >= 0)
+			close(pipes[p]);
+	close(master);
+	return failed || !WIFEXITED(status) || WEXITSTATUS(status);
+}
@@ -0,0 +1,461 @@
+/* tvi_fuzz.cpp, random scan code streams against a reference converter
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_fuzz [-n bytes] [-r rounds] [-s seed] [-v]
+//
+// Each round makes a stream of scan codes from the seed: ordinary keys,
+// E0 keys, modifiers, the locks, pause, PrtSc with its fake shifts,
+// overruns and self tests, with bytes dropped, duplicated and made up
+// along the way.  Every byte goes to the converter (converter_scan() on a
+// Converter of its own, as loop() would feed it) and to Reference below,
+// and after each one the TVI frames sent, the modifiers, the keys held and
+// the key repeating have to agree, and so do the frames from tvi_translate()
+// (tvi_translate.h) fed the same bytes.  The first byte where they don't is
+// printed with the scan codes before it, and the round stops there.
+//
+// Reference is the converter written the long way, the way loop() used to
+// be: prefix flags, the tables of tvi_legacy.h applied one after another,
+// and a switch for the E0 keys.  It follows the changes made on purpose
+// since then: keys don't send their own repeats (typematic.cpp does), a
+// self test or overrun lets go of everything, a held key made again after
+// another key is pressed anew, and a byte that doesn't fit the sequence so
+// far drops it and starts a new one.
+//
+// Afterwards the same streams are timed through decode() alone,
+// tvi_translate(), the whole converter and Reference, in scan codes per second of real time.  Build
+// with -DXLAT_COMPACT (tvi_fuzz_compact) or any other candidate to check
+// it the same way; "make -C host fuzz" runs both.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "hal_host.h"
+#include "../converter.h"
+#include "../tvi_legacy.h"
+#include "../ps2cmd.h"
+#include "tvi_translate.h"
+
+#define HISTORY		16		// Scan codes shown before a mismatch
+
+struct Reference {
+	bool e0, f0;
+	byte pause;			// Bytes of the pause sequence matched
+	bool pauseBreak;		// E1 F0 14 F0 77 rather than E1 14 77
+	byte modifier;
+	bool down[256];			// Numbered as in keys.h
+	byte last;			// The key made last
+	byte repeatKey, repeatMods;
+	uint16_t repeatFrame;
+	std::vector<uint16_t> frames;	// status << 8 | code
+
+	void reset(void);
+	void feed(byte b);
+	void make(byte code, bool ext);
+	void pressed(byte keycode);
+	void check(void);
+};
+
+void Reference::reset(void) {
+	e0 = f0 = false;
+	pause = 0;
+	modifier = MOD_NLOCK;
+	memset(down, 0, sizeof(down));
+	last = 0;
+	repeatKey = 0;
+	frames.clear();
+}
+
+static byte modifierBit(byte key) {
+	switch (key) {
+		case SCAN_LSHIFT:		return MOD_LSHIFT;
+		case SCAN_RSHIFT:		return MOD_RSHIFT;
+		case SCAN_CTRL:			return MOD_LCTRL;
+		case EXT_E0 | SCAN_CTRL:	return MOD_RCTRL;
+		case SCAN_ALT:			return MOD_LALT;
+		case EXT_E0 | SCAN_ALT:		return MOD_RALT;
+	}
+	return 0;
+}
+
+static byte e0Keycode(byte code) {
+	switch (code) {
+		case SCAN_E0_END:	return KEY_E0_END;
+		case SCAN_E0_LEFT:	return KEY_E0_LEFT;
+		case SCAN_E0_HOME:	return KEY_E0_HOME;
+		case SCAN_E0_INS:	return KEY_E0_INS;
+		case SCAN_E0_DEL:	return KEY_E0_DEL;
+		case SCAN_E0_DOWN:	return KEY_E0_DOWN;
+		case SCAN_E0_RIGHT:	return KEY_E0_RIGHT;
+		case SCAN_E0_UP:	return KEY_E0_UP;
+		case SCAN_E0_PGDN:	return KEY_E0_PGDN;
+		case SCAN_E0_PGUP:	return KEY_E0_PGUP;
+		case SCAN_E0_KPSL:	return KEY_KP_SLASH;
+		case SCAN_E0_KPENT:	return KEY_KP_ENTER;
+		case SCAN_E0_PRTSC:	return KEY_PRTSC;
+		case SCAN_E0_BREAK:	return KEY_BREAK;
+	}
+	return 0;
+}
+
+// A keycode to send, with whatever modifiers are held
+void Reference::pressed(byte keycode) {
+	byte status = 0;
+	uint16_t f;
+
+	if (!(modifier & MOD_NLOCK) && keycode >= KEY_KP_0 && keycode <= KEY_KP_DOT)
+		keycode += NLOCK_OFFSET;
+	if (modifier & (MOD_LSHIFT|MOD_RSHIFT))
+		status |= TVI_SHIFT;
+	if (modifier & MOD_CLOCK)
+		status |= TVI_ALOCK;
+	if (modifier & (MOD_LCTRL|MOD_RCTRL))
+		status |= TVI_CTRL;
+	f = legacyXlat(status, keycode);
+	if (modifier & (MOD_LALT|MOD_RALT))
+		f |= TVI_FUNCT << 8;
+	frames.push_back(f);
+	repeatFrame = f;
+	repeatMods = modifier;
+}
+
+// F7 is 83 and SysRq 84, so ext says whether key came after E0
+void Reference::make(byte code, bool ext) {
+	byte key = ext ? code | EXT_E0 : code;
+
+	if (down[key] && key == last)
+		return;			// The keyboard's own repeat
+	down[key] = true;
+	last = key;
+	if (modifierBit(key)) {
+		modifier |= modifierBit(key);
+	} else if (key == SCAN_CLOCK) {
+		modifier ^= MOD_CLOCK;
+	} else if (key == SCAN_NLOCK) {
+		modifier ^= MOD_NLOCK;
+	} else if (key == SCAN_SYSRQ) {
+		// Resets the terminal, nothing to send
+	} else if (ext) {
+		if (e0Keycode(code)) {
+			pressed(e0Keycode(code));
+			repeatKey = key;
+		}
+	} else if (key < NUM_PS2SCAN && ps2_to_intermediate[key]) {
+		pressed(ps2_to_intermediate[key]);
+		repeatKey = key;
+	}
+}
+
+// The repeat stops when its key is let go or the modifiers change
+void Reference::check(void) {
+	if (repeatKey && (!down[repeatKey] || modifier != repeatMods))
+		repeatKey = 0;
+}
+
+void Reference::feed(byte b) {
+	static const byte pauseMake[] = { 0xE1, SCAN_CTRL, SCAN_NLOCK };
+	static const byte pauseBrk[] = { 0xE1, 0xF0, SCAN_CTRL, 0xF0, SCAN_NLOCK };
+	byte key;
+
+	if (pause == 1 && (b == SCAN_CTRL || b == 0xF0)) {
+		pauseBreak = b == 0xF0;
+		pause++;
+		return;
+	}
+	if (pause > 1 && b == (pauseBreak ? pauseBrk : pauseMake)[pause]) {
+		if (++pause < (pauseBreak ? sizeof(pauseBrk) : sizeof(pauseMake)))
+			return;
+		pause = 0;
+		if (!pauseBreak) {
+			pressed(KEY_PAUSE);
+			repeatKey = 0;	// Which doesn't repeat
+			check();
+		}
+		return;
+	}
+	pause = 0;			// Anything else ends it, and starts over
+
+	if (b == 0xE1) {
+		e0 = f0 = false;
+		pause = 1;
+		return;
+	}
+	if (b == 0xE0) {
+		e0 = true;
+		return;
+	}
+	if (b == 0xF0) {
+		f0 = true;
+		return;
+	}
+	if (b == PS2_BAT_OK || b == PS2_OVERRUN) {
+		// Reset, plugged in or lost track: nothing is held any more
+		e0 = f0 = false;
+		memset(down, 0, sizeof(down));
+		last = 0;
+		modifier &= MOD_CLOCK|MOD_NLOCK;
+		check();
+		return;
+	}
+	if (b == 0 || b > SCAN_SYSRQ || (e0 && (b | EXT_E0) <= SCAN_SYSRQ)) {
+		e0 = f0 = false;	// No key sends these
+		return;
+	}
+	key = e0 ? b | EXT_E0 : b;
+	if (f0) {
+		down[key] = false;
+		modifier &= ~modifierBit(key);
+	} else {
+		make(b, e0);
+	}
+	e0 = f0 = false;
+	check();
+}
+
+// ---- Streams ----
+
+static uint32_t rng;
+
+static unsigned rnd(unsigned n) {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng % n;
+}
+
+static const byte e0Codes[] = {
+	SCAN_ALT, SCAN_CTRL, SCAN_LSHIFT, SCAN_RSHIFT, 0x1F, 0x27, 0x2F, 0x37, 0x3F,
+	0x5E, SCAN_E0_KPSL, SCAN_E0_KPENT, SCAN_E0_END, SCAN_E0_LEFT, SCAN_E0_HOME,
+	SCAN_E0_INS, SCAN_E0_DEL, SCAN_E0_DOWN, SCAN_E0_RIGHT, SCAN_E0_UP,
+	SCAN_E0_PGDN, SCAN_E0_PGUP, SCAN_E0_PRTSC, SCAN_E0_BREAK
+};
+static const byte modCodes[] = { SCAN_LSHIFT, SCAN_RSHIFT, SCAN_CTRL, SCAN_ALT };
+
+// One key going down or up, or some other thing a keyboard sends
+static void event(std::vector<byte> &s) {
+	static const byte pause[] = { 0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77 };
+	static const byte prtsc[] = { 0xE0, 0x12, 0xE0, 0x7C, 0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12 };
+	static const byte ctrlBreak[] = { 0xE0, 0x7E, 0xE0, 0xF0, 0x7E };
+	std::vector<byte> e;
+	unsigned r = rnd(100), i;
+	bool brk = rnd(5) < 2;
+
+	if (r < 50) {
+		if (brk)
+			e.push_back(0xF0);
+		e.push_back(1 + rnd(SCAN_SYSRQ - 1));
+	} else if (r < 65) {
+		e.push_back(0xE0);
+		if (brk)
+			e.push_back(0xF0);
+		e.push_back(e0Codes[rnd(sizeof(e0Codes))]);
+	} else if (r < 75) {
+		if (rnd(3) == 0)
+			e.push_back(0xE0);
+		if (brk)
+			e.push_back(0xF0);
+		e.push_back(modCodes[rnd(sizeof(modCodes))]);
+	} else if (r < 80) {
+		if (brk)
+			e.push_back(0xF0);
+		e.push_back(rnd(2) ? SCAN_CLOCK : SCAN_NLOCK);
+	} else if (r < 83) {
+		e.assign(pause, pause + sizeof(pause));
+	} else if (r < 85) {
+		e.assign(prtsc, prtsc + sizeof(prtsc));
+	} else if (r < 87) {
+		e.assign(ctrlBreak, ctrlBreak + sizeof(ctrlBreak));
+	} else if (r < 89) {
+		e.push_back(rnd(3) == 0 ? 0 : rnd(2) ? PS2_BAT_OK : PS2_OVERRUN);
+	} else if (r < 99) {
+		e.push_back(rnd(256));
+	} else {
+		e.push_back(SCAN_SYSRQ);
+	}
+
+	// Then spoil some of them
+	r = rnd(100);
+	if (r < 8 && e.size() > 1) {
+		e.erase(e.begin() + rnd(e.size()));
+	} else if (r < 12) {
+		i = rnd(e.size() + 1);
+		e.insert(e.begin() + i, i && rnd(2) ? e[i-1] : rnd(256));
+	} else if (r < 15 && e.size() > 1) {
+		e.resize(1 + rnd(e.size() - 1));
+	}
+	s.insert(s.end(), e.begin(), e.end());
+}
+
+// ---- Comparing ----
+
+static Converter cand;
+static TviTranslator tr;
+static Reference ref;
+
+static void startRound(void) {
+	converter_begin(cand, &Serial, RSTOUT_PIN, false);
+	tvi_translate_begin(tr);
+	ref.reset();
+}
+
+static void printFrames(const char *who, const uint16_t *f, size_t n) {
+	size_t i;
+
+	printf("  %-10s", who);
+	for (i=0; i<n; i++)
+		printf(" %02X %02X", f[i] >> 8, f[i] & 0xFF);
+	printf(n ? "\n" : " nothing\n");
+}
+
+// Feed one byte to both, returns false if they disagree after it
+static bool step(byte b, size_t *logPos) {
+	std::vector<uint16_t> got, batch;
+	const HostTx *log;
+	byte out[2];
+	size_t n;
+	unsigned k;
+	bool ok;
+
+	ref.frames.clear();
+	ref.feed(b);
+	converter_scan(cand, b);
+	log = host_serialLog(&n);
+	for (; *logPos + 1 < n; *logPos += 2)
+		got.push_back(log[*logPos].c << 8 | log[*logPos + 1].c);
+	if (tvi_translate(tr, &b, 1, out))
+		batch.push_back(out[0] << 8 | out[1]);
+
+	ok = got == ref.frames && batch == ref.frames && cand.modifier == ref.modifier && cand.rep.key == ref.repeatKey
+		&& (!ref.repeatKey || (cand.rep.mods == ref.repeatMods
+			&& (cand.rep.status << 8 | cand.rep.code) == ref.repeatFrame));
+	for (k=0; ok && k<256; k++)
+		ok = keys_isDown(cand.keys, k) == ref.down[k];
+	if (ok)
+		return true;
+
+	printFrames("reference", ref.frames.data(), ref.frames.size());
+	printFrames("converter", got.data(), got.size());
+	printFrames("translate", batch.data(), batch.size());
+	if (cand.modifier != ref.modifier)
+		printf("  modifiers  %02X, converter %02X\n", ref.modifier, cand.modifier);
+	if (cand.rep.key != ref.repeatKey)
+		printf("  repeating  %02X, converter %02X\n", ref.repeatKey, cand.rep.key);
+	for (k=0; k<256; k++)
+		if (keys_isDown(cand.keys, k) != ref.down[k])
+			printf("  key %02X     %s, converter %s\n", k,
+				ref.down[k] ? "down" : "up", ref.down[k] ? "up" : "down");
+	return false;
+}
+
+static double nowSec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	long nbytes = 10000, rounds = 200, r;
+	unsigned long seed = 1;
+	std::vector<std::vector<byte> > streams;
+	size_t i, j, logPos = 0, total = 0;
+	bool verbose = false;
+	int opt, failed = 0;
+	double t, tDecode, tBatch, tConv, tRef;
+	Decoder dec;
+	Keys keys;
+	byte key, sink = 0;
+	std::vector<byte> frames;
+
+	while ((opt = getopt(argc, argv, "n:r:s:v")) != -1) {
+		switch (opt) {
+			case 'n': nbytes = atol(optarg); break;
+			case 'r': rounds = atol(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-n bytes] [-r rounds] [-s seed] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	// A line that never holds anything up, so frames show up as they're put
+	Serial.begin(100000000UL);
+	for (r=0; r<rounds; r++) {
+		std::vector<byte> s;
+
+		rng = (seed + r) * 2654435761UL | 1;
+		while ((long)s.size() < nbytes)
+			event(s);
+		startRound();
+		for (i=0; i<s.size(); i++) {
+			if (!step(s[i], &logPos)) {
+				printf("round %ld (seed %lu) differs at byte %zu:", r, seed + r, i);
+				for (j = i > HISTORY ? i - HISTORY : 0; j<=i; j++)
+					printf(j == i ? " [%02X]" : " %02X", s[j]);
+				printf("\n");
+				failed++;
+				break;
+			}
+		}
+		if (verbose)
+			printf("round %ld: %zu scan codes\n", r, s.size());
+		total += s.size();
+		streams.push_back(s);
+	}
+
+	t = nowSec();
+	for (const auto &s : streams) {
+		decode_reset(dec);
+		keys_reset(keys);
+		for (byte b : s)
+			sink += decode(dec, keys, b, &key);
+	}
+	tDecode = nowSec() - t;
+	t = nowSec();
+	for (const auto &s : streams) {
+		frames.resize(2 * s.size());
+		sink += tvi_translate(s.data(), s.size(), frames.data());
+	}
+	tBatch = nowSec() - t;
+	t = nowSec();
+	for (const auto &s : streams) {
+		startRound();
+		for (byte b : s)
+			converter_scan(cand, b);
+	}
+	tConv = nowSec() - t;
+	t = nowSec();
+	for (const auto &s : streams) {
+		ref.reset();
+		for (byte b : s)
+			ref.feed(b);
+	}
+	tRef = nowSec() - t;
+
+	printf("rounds            %ld, %d differ\n", rounds, failed);
+	printf("scan codes        %zu\n", total);
+	printf("decode            %.1f M scan codes/s\n", total / tDecode / 1e6 + 0 * sink);
+	printf("translate         %.1f M scan codes/s\n", total / tBatch / 1e6);
+	printf("converter         %.1f M scan codes/s\n", total / tConv / 1e6);
+	printf("reference         %.1f M scan codes/s\n", total / tRef / 1e6);
+	return failed != 0;
+}
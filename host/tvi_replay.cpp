@@ -0,0 +1,369 @@
+/* tvi_replay.cpp, replays scan code traces through PS2_TVI.cpp and diffs the output
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_replay [-j jobs] [-u] [-v] trace...
+//
+// Each trace (see trace.h, or a tvi_bench -s style text file of
+// "<time in us> <hex code>" lines) is played into the emulated keyboard at
+// its recorded times and the TVI frames the converter sends are compared
+// with the ones in the trace.  The first mismatch of each trace is printed
+// with the scan codes leading up to it.  Traces run in forked children, -j
+// at a time, each starting from a freshly reset converter.  A trace that
+// says it dropped records (TR_LOST) can't be trusted and fails too.
+//
+// -u writes this build's output back into each trace instead of comparing
+// (text files get a new .tvt next to them), which is how a corpus is made.
+// The summary gives throughput in scan codes per second of real time and
+// the virtual latency from a scan code arriving to its frame being written,
+// next to the latency the trace itself recorded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <string>
+#include "hal_host.h"
+#include "../trace.h"
+#include "../converter.h"
+
+void setup(void);
+void loop(void);
+
+#define BOOT_US		1000000		// Reset and self test before the trace starts
+#define SETTLE_US	100000		// Time after the last scan code for output
+#define NBUCKETS	24		// Latency histogram, powers of two in us
+
+struct Event {
+	uint64_t t;			// us from the start of the trace
+	uint8_t type, a, b;
+};
+
+struct Result {
+	unsigned long scans, expected, got;
+	int ok, failed;			// Parsed and ran / output differed
+	unsigned long lat[NBUCKETS], rec[NBUCKETS];
+	uint64_t latSum, latMax, recSum, recMax, recN;
+	unsigned long lost;		// Records the trace says it dropped
+};
+
+static bool update, verbose;
+
+static int bucket(uint64_t us) {
+	int b = 0;
+
+	while (us > 1 && b < NBUCKETS-1) {
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static bool readTrace(const char *path, std::vector<Event> &ev, unsigned long *lost) {
+	FILE *f = fopen(path, "rb");
+	uint8_t rec[TRACE_REC], hdr[4];
+	uint64_t t = 0, dt;
+	Event e;
+
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	if (fread(hdr, 1, 4, f) == 4 && !memcmp(hdr, "TVT", 3)) {
+		if (hdr[3] != TRACE_VERSION) {
+			fprintf(stderr, "%s: trace version %d\n", path, hdr[3]);
+			fclose(f);
+			return false;
+		}
+		while (fread(rec, 1, TRACE_REC, f) == TRACE_REC) {
+			dt = rec[3] | rec[4] << 8;
+			if (rec[0] == TR_GAP)
+				dt |= (uint64_t)(rec[1] | rec[2] << 8) << 16;
+			t += dt * TRACE_TICK_US;
+			e.t = t;
+			e.type = rec[0];
+			e.a = rec[1];
+			e.b = rec[2];
+			if (e.type == TR_LOST) {
+				fprintf(stderr, "%s: %d records lost at %llu us\n", path, e.a,
+					(unsigned long long)t);
+				*lost += e.a;
+			}
+			if (e.type == TR_SCAN || e.type == TR_TVI)
+				ev.push_back(e);
+		}
+	} else {
+		unsigned long long at;
+		unsigned code;
+
+		rewind(f);
+		while (fscanf(f, "%llu %x", &at, &code) == 2) {
+			e.t = at;
+			e.type = TR_SCAN;
+			e.a = code;
+			e.b = 0;
+			ev.push_back(e);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+static void putRec(FILE *f, uint8_t type, uint8_t a, uint8_t b, uint64_t *last, uint64_t t) {
+	uint64_t dt = t / TRACE_TICK_US - *last / TRACE_TICK_US;
+	uint8_t rec[TRACE_REC];
+
+	if (dt > 0xFFFF) {
+		rec[0] = TR_GAP;
+		rec[1] = dt >> 16;
+		rec[2] = dt >> 24;
+		rec[3] = dt & 0xFF;
+		rec[4] = dt >> 8;
+		fwrite(rec, 1, TRACE_REC, f);
+		dt = 0;
+	}
+	rec[0] = type;
+	rec[1] = a;
+	rec[2] = b;
+	rec[3] = dt & 0xFF;
+	rec[4] = dt >> 8;
+	fwrite(rec, 1, TRACE_REC, f);
+	*last = t;
+}
+
+// The scan codes of the trace with this run's frames, in time order
+static void writeTrace(const char *path, const std::vector<Event> &ev,
+		const HostTx *log, size_t from, size_t n, uint64_t base) {
+	std::string out = path;
+	uint64_t last = 0;
+	FILE *f;
+
+	if (out.size() < 4 || out.compare(out.size() - 4, 4, ".tvt"))
+		out += ".tvt";
+	if (!(f = fopen(out.c_str(), "wb"))) {
+		perror(out.c_str());
+		return;
+	}
+	fprintf(f, "TVT%c", TRACE_VERSION);
+	for (const Event &e : ev) {
+		if (e.type != TR_SCAN)
+			continue;
+		for (; from + 1 < n && log[from].written - base <= e.t; from += 2)
+			putRec(f, TR_TVI, log[from].c, log[from+1].c, &last, log[from].written - base);
+		putRec(f, TR_SCAN, e.a, 0, &last, e.t);
+	}
+	for (; from + 1 < n; from += 2)
+		putRec(f, TR_TVI, log[from].c, log[from+1].c, &last, log[from].written - base);
+	fclose(f);
+}
+
+static void replay(const char *path, Result *r) {
+	std::vector<Event> ev, want;
+	uint64_t base, end = 0, lastScan = 0, lat;
+	size_t n, from, i, j;
+	const HostTx *log;
+
+	if (!readTrace(path, ev, &r->lost))
+		return;
+
+	setup();
+	while (host_now() < BOOT_US)
+		loop();
+	host_serialLog(&from);
+	base = host_now();
+	for (const Event &e : ev) {
+		if (e.type == TR_SCAN) {
+			host_kbdQueue(e.a, base + e.t);
+			end = e.t;
+			lastScan = e.t;
+			r->scans++;
+		} else {
+			want.push_back(e);
+			r->expected++;
+			r->rec[bucket(e.t - lastScan)]++;
+			r->recSum += e.t - lastScan;
+			if (e.t - lastScan > r->recMax)
+				r->recMax = e.t - lastScan;
+			r->recN++;
+		}
+	}
+	while (host_kbdPending() || tviq_count(converters[0].txq) || host_now() < base + end + SETTLE_US)
+		loop();
+
+	log = host_serialLog(&n);
+	r->got = (n - from) / 2;
+	for (i=from; i+1<n; i+=2) {
+		lat = log[i+1].written - log[i+1].scan;
+		r->lat[bucket(lat)]++;
+		r->latSum += lat;
+		if (lat > r->latMax)
+			r->latMax = lat;
+	}
+	r->ok = 1;
+
+	if (update) {
+		writeTrace(path, ev, log, from, n, base);
+		return;
+	}
+	for (i=from, j=0; i+1<n && j<want.size(); i+=2, j++)
+		if (log[i].c != want[j].a || log[i+1].c != want[j].b)
+			break;
+	if (i+1 >= n && j == want.size())
+		return;
+
+	r->failed = 1;
+	fprintf(stderr, "%s: frame %zu", path, j);
+	if (j < want.size())
+		fprintf(stderr, " expected %02X %02X at %llu us", want[j].a, want[j].b,
+			(unsigned long long)want[j].t);
+	else
+		fprintf(stderr, " expected nothing");
+	if (i+1 < n)
+		fprintf(stderr, ", got %02X %02X at %llu us", log[i].c, log[i+1].c,
+			(unsigned long long)(log[i].written - base));
+	else
+		fprintf(stderr, ", got nothing");
+	fprintf(stderr, " (%lu frames expected, %lu sent)\n", r->expected, r->got);
+
+	// The scan codes leading up to it
+	lastScan = j < want.size() ? want[j].t : (i+1 < n ? log[i].written - base : UINT64_MAX);
+	std::vector<uint8_t> before;
+	for (const Event &e : ev)
+		if (e.type == TR_SCAN && e.t <= lastScan)
+			before.push_back(e.a);
+	fprintf(stderr, "  after scan codes");
+	for (i = before.size() > 12 ? before.size() - 12 : 0; i < before.size(); i++)
+		fprintf(stderr, " %02X", before[i]);
+	fprintf(stderr, "\n");
+}
+
+static uint64_t percentile(const unsigned long *h, unsigned long total, double p) {
+	unsigned long seen = 0;
+	int b;
+
+	for (b=0; b<NBUCKETS; b++) {
+		seen += h[b];
+		if (seen >= total * p)
+			return 1ULL << b;
+	}
+	return 1ULL << (NBUCKETS-1);
+}
+
+static double nowSec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	int jobs = 1, running = 0, opt, fd[2], traces = 0, failed = 0, bad = 0, lossy = 0, b;
+	Result total, r;
+	unsigned long nlat;
+	double wall;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "j:uv")) != -1) {
+		switch (opt) {
+			case 'j': jobs = atoi(optarg); break;
+			case 'u': update = true; break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-j jobs] [-u] [-v] trace...\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind >= argc || pipe(fd)) {
+		fprintf(stderr, "usage: %s [-j jobs] [-u] [-v] trace...\n", argv[0]);
+		return 2;
+	}
+	if (jobs < 1)
+		jobs = 1;
+
+	memset(&total, 0, sizeof(total));
+	wall = nowSec();
+	for (int i = optind; i < argc || running; ) {
+		if (i < argc && running < jobs) {
+			if ((pid = fork()) == 0) {
+				close(fd[0]);
+				memset(&r, 0, sizeof(r));
+				replay(argv[i], &r);
+				if (verbose)
+					printf("%s: %lu scan codes, %lu frames%s\n", argv[i],
+						r.scans, r.got, r.failed ? ", differs" : "");
+				fflush(stdout);
+				if (write(fd[1], &r, sizeof(r)) != sizeof(r))
+					_exit(1);
+				_exit(0);
+			}
+			if (pid < 0) {
+				perror("fork");
+				return 1;
+			}
+			running++;
+			i++;
+			continue;
+		}
+		// Results are small enough for the pipe to keep them whole
+		if (read(fd[0], &r, sizeof(r)) != sizeof(r))
+			break;
+		wait(NULL);
+		running--;
+		traces++;
+		failed += r.failed;
+		bad += !r.ok;
+		lossy += r.lost != 0;
+		total.scans += r.scans;
+		total.expected += r.expected;
+		total.got += r.got;
+		for (b=0; b<NBUCKETS; b++) {
+			total.lat[b] += r.lat[b];
+			total.rec[b] += r.rec[b];
+		}
+		total.latSum += r.latSum;
+		total.recSum += r.recSum;
+		total.recN += r.recN;
+		if (r.latMax > total.latMax)
+			total.latMax = r.latMax;
+		if (r.recMax > total.recMax)
+			total.recMax = r.recMax;
+	}
+	wall = nowSec() - wall;
+
+	nlat = total.got;
+	printf("traces            %d (%d differ, %d unreadable, %d with records lost)\n",
+		traces, failed, bad, lossy);
+	printf("scan codes        %lu\n", total.scans);
+	printf("TVI frames        %lu sent, %lu in traces\n", total.got, total.expected);
+	printf("throughput        %.0f scan codes/s\n", total.scans / (wall > 0 ? wall : 1e-9));
+	if (nlat)
+		printf("latency           mean %.1f us, p50 <%llu us, p99 <%llu us, max %llu us\n",
+			(double)total.latSum / nlat,
+			(unsigned long long)percentile(total.lat, nlat, 0.5) * 2,
+			(unsigned long long)percentile(total.lat, nlat, 0.99) * 2,
+			(unsigned long long)total.latMax);
+	if (total.recN)
+		printf("recorded latency  mean %.1f us, p99 <%llu us, max %llu us\n",
+			(double)total.recSum / total.recN,
+			(unsigned long long)percentile(total.rec, total.recN, 0.99) * 2,
+			(unsigned long long)total.recMax);
+	return failed || bad || lossy ? 1 : 0;
+}
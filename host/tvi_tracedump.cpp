@@ -0,0 +1,132 @@
+/* tvi_tracedump.cpp, prints trace.h traces as text
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_tracedump trace...
+//
+// Takes captured traces ("TVT", see trace.h) and TRACE_RING dumps ("TVR")
+// and prints a line per record: the time, what it was and its contents.
+// Capture times are from the start of the trace; ring times count from the
+// oldest record and, like hal_stamp(), lose whole 32.8ms periods.
+
+#include <stdio.h>
+#include <string.h>
+#include "../hal.h"
+#include "../trace.h"
+#include "../decode.h"
+#include "../keys.h"
+
+static void printKey(byte key) {
+	if (key & EXT_E0)
+		printf("E0 %02X", key & ~EXT_E0);
+	else
+		printf("%02X", key);
+}
+
+static void printRec(double us, const uint8_t *r) {
+	static const char *results[] = { "none", "make", "break", "pause", "special" };
+
+	printf("%12.1f  ", us);
+	switch (r[0]) {
+		case TR_SCAN:
+			printf("scan   %02X\n", r[1]);
+			break;
+		case TR_KEY:
+			printf("key    %-7s ", r[1] <= DEC_SPECIAL ? results[r[1]] : "?");
+			printKey(r[2]);
+			printf("\n");
+			break;
+		case TR_XLAT:
+			printf("xlat   %02X %02X\n", r[1], r[2]);
+			break;
+		case TR_TVI:
+			printf("tvi    %02X %02X\n", r[1], r[2]);
+			break;
+		case TR_CMD:
+			printf("cmd    %02X -> %02X%s\n", r[1], r[2], r[2] ? "" : " (no answer)");
+			break;
+		case TR_HOST:
+			printf("host   %02X%s\n", r[1], r[2] ? "" : " (captured)");
+			break;
+		case TR_LOST:
+			printf("lost   %u records\n", r[1]);
+			break;
+		default:
+			printf("type %u %02X %02X\n", r[0], r[1], r[2]);
+			break;
+	}
+}
+
+static int dump(const char *path) {
+	FILE *f = fopen(path, "rb");
+	uint8_t hdr[5], r[TRACE_REC];
+	unsigned n, i, dt;
+	uint16_t last = 0;
+	double t = 0;
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+	if (fread(hdr, 1, 4, f) != 4 || hdr[0] != 'T' || hdr[1] != 'V'
+			|| (hdr[2] != 'T' && hdr[2] != 'R') || hdr[3] != TRACE_VERSION) {
+		fprintf(stderr, "%s: not a version %d trace\n", path, TRACE_VERSION);
+		fclose(f);
+		return 1;
+	}
+	if (hdr[2] == 'T') {
+		while (fread(r, 1, TRACE_REC, f) == TRACE_REC) {
+			dt = r[3] | r[4] << 8;
+			if (r[0] == TR_GAP)
+				dt |= (unsigned)(r[1] | r[2] << 8) << 16;
+			t += (double)dt * TRACE_TICK_US;
+			if (r[0] != TR_GAP)
+				printRec(t, r);
+		}
+	} else {
+		n = fread(hdr + 4, 1, 1, f) == 1 ? hdr[4] : 0;
+		for (i=0; i<n && fread(r, 1, TRACE_REC, f) == TRACE_REC; i++) {
+			if (i)
+				dt = (uint16_t)((r[3] | r[4] << 8) - last);
+			else
+				dt = 0;
+			last = r[3] | r[4] << 8;
+			t += dt * HAL_STAMP_NS / 1000.0;
+			printRec(t, r);
+		}
+		if (i < n)
+			fprintf(stderr, "%s: %u of %u records\n", path, i, n);
+	}
+	fclose(f);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int i, err = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace...\n", argv[0]);
+		return 2;
+	}
+	for (i=1; i<argc; i++) {
+		if (argc > 2)
+			printf("%s:\n", argv[i]);
+		err |= dump(argv[i]);
+	}
+	return err;
+}
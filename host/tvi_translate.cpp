@@ -0,0 +1,193 @@
+/* tvi_translate.cpp, turns keyboard logs into TVI streams
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_translate [-s] [-o outfile] file...
+//        tvi_translate -b megabytes
+//
+// Reads each file (- for stdin) as raw scan codes, or with -s as tvi_bench
+// -s style lines of "<time in us> <hex code>", and writes the TVI frames a
+// freshly reset converter would send for it, see tvi_translate.h, to
+// outfile or stdout, one file after another.  The rate is on stderr.  A
+// line that isn't one of those, or a read or write that fails, stops it
+// with the file and line and exit status 1.
+//
+// -b times tvi_translate() over that much made up typing instead.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "tvi_translate.h"
+
+#define CHUNK	65536
+
+static double nowSec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Letters, digits and the odd shifted one, down and up
+static void typing(std::vector<byte> &s, size_t n) {
+	static const byte keys[] = { 0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33,
+		0x43, 0x3B, 0x42, 0x4B, 0x3A, 0x31, 0x44, 0x4D, 0x15, 0x2D, 0x1B, 0x2C,
+		0x3C, 0x2A, 0x1D, 0x22, 0x35, 0x1A, 0x29, 0x5A, 0x16, 0x1E, 0x26, 0x25 };
+	uint32_t r = 1;
+	byte k;
+
+	while (s.size() < n) {
+		r = r * 1103515245 + 12345;
+		k = keys[(r >> 16) % sizeof(keys)];
+		if (((r >> 24) & 7) == 0)
+			s.push_back(0x12);
+		s.push_back(k);
+		s.push_back(0xF0);
+		s.push_back(k);
+		if (((r >> 24) & 7) == 0) {
+			s.push_back(0xF0);
+			s.push_back(0x12);
+		}
+	}
+}
+
+// Up to max codes from "<time> <code>" lines into buf, blank lines skipped.
+// false, having said where, on anything else.
+static bool readLines(FILE *in, const char *name, unsigned long *line,
+		byte *buf, size_t max, size_t *n) {
+	char text[256], extra;
+	unsigned long long at;
+	unsigned code;
+	int got;
+
+	for (*n=0; *n<max && fgets(text, sizeof(text), in); ) {
+		++*line;
+		got = sscanf(text, "%llu %x %c", &at, &code, &extra);
+		if (got == EOF)
+			continue;
+		if (got != 2 || code > 0xFF || (!strchr(text, '\n') && !feof(in))) {
+			fprintf(stderr, "%s:%lu: not \"<time in us> <hex code>\"\n", name, *line);
+			return false;
+		}
+		buf[(*n)++] = code;
+	}
+	return true;
+}
+
+static int bench(double mb) {
+	std::vector<byte> in, out;
+	size_t i, n = 0;
+	double t;
+	int passes = 0;
+
+	typing(in, mb * 1e6);
+	out.resize(2 * CHUNK);
+	t = nowSec();
+	do {
+		TviTranslator tr;
+
+		tvi_translate_begin(tr);
+		for (i=0; i<in.size(); i+=CHUNK)
+			n += tvi_translate(tr, &in[i], std::min((size_t)CHUNK, in.size() - i), &out[0]);
+		passes++;
+	} while (nowSec() - t < 1);
+	t = nowSec() - t;
+	printf("scan codes        %zu x %d\n", in.size(), passes);
+	printf("TVI bytes         %zu\n", n);
+	printf("translate         %.1f MB/s of scan codes\n", in.size() * passes / t / 1e6);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *outFile = NULL;
+	bool text = false;
+	double mb = 0, t;
+	int opt, i;
+	FILE *in, *out = stdout;
+	byte buf[CHUNK], frames[2 * CHUNK];
+	unsigned long line;
+	size_t n, f, total = 0;
+
+	while ((opt = getopt(argc, argv, "so:b:")) != -1) {
+		switch (opt) {
+			case 's': text = true; break;
+			case 'o': outFile = optarg; break;
+			case 'b': mb = atof(optarg); break;
+			default:
+				mb = -1;
+				break;
+		}
+	}
+	if (mb > 0)
+		return bench(mb);
+	if (mb < 0 || optind == argc) {
+		fprintf(stderr, "usage: %s [-s] [-o outfile] file...\n       %s -b megabytes\n",
+			argv[0], argv[0]);
+		return 2;
+	}
+	if (outFile && !(out = fopen(outFile, "wb"))) {
+		perror(outFile);
+		return 1;
+	}
+
+	t = nowSec();
+	for (i=optind; i<argc; i++) {
+		TviTranslator tr;
+
+		in = strcmp(argv[i], "-") ? fopen(argv[i], text ? "r" : "rb") : stdin;
+		if (!in) {
+			perror(argv[i]);
+			return 1;
+		}
+		tvi_translate_begin(tr);
+		line = 0;
+		for (;;) {
+			if (text) {
+				if (!readLines(in, argv[i], &line, buf, CHUNK, &n))
+					return 1;
+			} else {
+				n = fread(buf, 1, CHUNK, in);
+			}
+			if (!n)
+				break;
+			total += n;
+			f = tvi_translate(tr, buf, n, frames);
+			if (fwrite(frames, 1, f, out) != f) {
+				perror(outFile ? outFile : "stdout");
+				return 1;
+			}
+		}
+		if (ferror(in)) {
+			perror(argv[i]);
+			return 1;
+		}
+		if (in != stdin)
+			fclose(in);
+	}
+	t = nowSec() - t;
+	if (out != stdout ? fclose(out) : fflush(out) || ferror(out)) {
+		perror(outFile ? outFile : "stdout");
+		return 1;
+	}
+	fprintf(stderr, "%zu scan codes, %.1f MB/s\n", total, total / t / 1e6);
+	return 0;
+}
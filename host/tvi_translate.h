@@ -0,0 +1,126 @@
+/* tvi_translate.h, scan codes to TVI frames in bulk, for the host tools
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// What converter_scan() does with a keyboard's bytes, less everything that
+// needs a board or a clock: no queue, no trace or stats, no macros, no
+// Sys-Rq reset and no typematic repeats, since a log has no timing.  The
+// frames go straight into the caller's buffer as status, code byte pairs,
+// two bytes at most per scan code.
+//
+// This isn't header only: it's inline on top of the firmware's own
+// decode(), keys_* and xlat_frame(), so link decode.cpp, keys.cpp and
+// tvi_xlat.cpp along ($(TRANSLATE) in the Makefile), and nothing else, not
+// even the HAL; a copy of the tables would only drift from the ones on the
+// board.  Build with -DXLAT_COMPACT or -DDECODE_SET3 to translate as those
+// builds would.
+//
+// The decoder is a state machine, every byte depending on the ones before
+// it, so there is nothing to split across SIMD lanes in one stream; the
+// speed comes from a tight loop with the tables in cache, and from reading
+// the modifiers back out of the key map only when a modifier key moved.
+// Streams of different keyboards are independent and can go to threads or
+// processes.
+//
+//	TviTranslator t;
+//	tvi_translate_begin(t);
+//	while ((n = fread(in, 1, sizeof(in), f)) > 0)	// out is 2 * sizeof(in)
+//		fwrite(out, 1, tvi_translate(t, in, n, out), g);
+//
+// or for a whole log at once, tvi_translate(in, n, out).
+
+#ifndef TVI_TRANSLATE_H
+#define TVI_TRANSLATE_H
+
+#include "../hal.h"
+#include "../PS2_TVI.h"
+#include "../decode.h"
+#include "../keys.h"
+#include "../tvi_xlat.h"
+
+// Where one keyboard's stream is up to, carried from call to call
+struct TviTranslator {
+	Decoder dec;
+	Keys keys;
+	byte modifier;			// MOD_* as in the converter
+};
+
+// A keyboard just after its self test: nothing held, numlock on
+static inline void tvi_translate_begin(TviTranslator &t) {
+	decode_reset(t.dec);
+	keys_reset(t.keys);
+	t.modifier = MOD_NLOCK;
+}
+
+// Translate n scan codes, continuing from the last call, into out, which
+// needs room for 2 * n bytes; returns how many it wrote
+static inline size_t tvi_translate(TviTranslator &t, const byte *scan, size_t n, byte *out) {
+	byte *o = out;
+	byte mod = t.modifier;
+	byte key, keycode, action;
+	uint16_t f;
+
+	for (; n; n--) {
+		keycode = 0;
+		switch (decode(t.dec, t.keys, *scan++, &key)) {
+			case DEC_MAKE:
+				if (keys_press(t.keys, key))
+					break;		// The keyboard's own repeat
+				action = decode_action(key);
+				if (action == ACT_MOD)
+					mod = (mod & (MOD_CLOCK|MOD_NLOCK)) | keys_modifiers(t.keys);
+				else if (action >= ' ')
+					keycode = action;
+				else if (action == ACT_CLOCK)
+					mod ^= MOD_CLOCK;
+				else if (action == ACT_NLOCK)
+					mod ^= MOD_NLOCK;
+				break;
+			case DEC_BREAK:
+				keys_release(t.keys, key);
+				if (decode_action(key) == ACT_MOD)
+					mod = (mod & (MOD_CLOCK|MOD_NLOCK)) | keys_modifiers(t.keys);
+				break;
+			case DEC_PAUSE:
+				keycode = KEY_PAUSE;
+				break;
+			case DEC_SPECIAL:
+				// Reset, plugged in or lost track: nothing is held now
+				keys_reset(t.keys);
+				mod &= MOD_CLOCK|MOD_NLOCK;
+				break;
+		}
+		if (keycode) {
+			f = xlat_frame(mod, keycode);
+			*o++ = f >> 8;
+			*o++ = f & 0xFF;
+		}
+	}
+	t.modifier = mod;
+	return o - out;
+}
+
+// A whole stream from a freshly reset keyboard
+static inline size_t tvi_translate(const byte *scan, size_t n, byte *out) {
+	TviTranslator t;
+
+	tvi_translate_begin(t);
+	return tvi_translate(t, scan, n, out);
+}
+
+#endif
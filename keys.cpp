@@ -0,0 +1,55 @@
+/* keys.cpp, which keys are held down
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Every make and break code updates the Keys map, and the shift, control and
+// alt state is read back from it rather than kept separately, so a break
+// code that goes missing for one key can't leave another one stuck.  When
+// the keyboard resets or reports an overrun everything is released at once,
+// and so it is when ps2rx.cpp loses a byte.  A make of a key that's already
+// down but isn't the one the keyboard could be repeating is taken as the
+// break having gone missing, see keys_press().
+
+#include "keys.h"
+
+void keys_reset(Keys &k) {
+	byte i;
+
+	for (i=0; i<sizeof(k.down); i++)
+		k.down[i] = 0;
+	k.last = 0;
+}
+
+// MOD_ bits for the shift, control and alt keys held down
+byte keys_modifiers(const Keys &k) {
+	byte mod = 0;
+
+	if (keys_isDown(k, SCAN_LSHIFT))
+		mod |= MOD_LSHIFT;
+	if (keys_isDown(k, SCAN_RSHIFT))
+		mod |= MOD_RSHIFT;
+	if (keys_isDown(k, SCAN_CTRL))
+		mod |= MOD_LCTRL;
+	if (keys_isDown(k, EXT_E0 | SCAN_CTRL))
+		mod |= MOD_RCTRL;
+	if (keys_isDown(k, SCAN_ALT))
+		mod |= MOD_LALT;
+	if (keys_isDown(k, EXT_E0 | SCAN_ALT))
+		mod |= MOD_RALT;
+	return mod;
+}
@@ -0,0 +1,60 @@
+/* keys.h, which keys are held down
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KEYS_H
+#define KEYS_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+
+// Keys are numbered by their set 2 make code, with EXT_E0 added for the
+// ones that come after an E0 prefix.  No real E0 code is below 0x10, so
+// F7 (83) and Alt+PrtSc (84) don't collide with anything; decode.cpp drops
+// the E0 codes that would.
+#define EXT_E0		0x80
+
+struct Keys {
+	byte down[32];			// One bit per key
+	byte last;			// Made last, the only key the keyboard repeats
+};
+
+static inline bool keys_isDown(const Keys &k, byte key) {
+	return k.down[key >> 3] & (1 << (key & 7));
+}
+
+// Mark key as down, returns true if it's the keyboard's typematic repeat:
+// down already and the last key made.  A key down already when another one
+// was made since has lost its break on the way, and this is a new press.
+static inline bool keys_press(Keys &k, byte key) {
+	byte was = k.down[key >> 3];
+	byte last = k.last;
+
+	k.down[key >> 3] = was | (1 << (key & 7));
+	k.last = key;
+	return (was & (1 << (key & 7))) && key == last;
+}
+
+static inline void keys_release(Keys &k, byte key) {
+	k.down[key >> 3] &= ~(1 << (key & 7));
+}
+
+void keys_reset(Keys &k);
+byte keys_modifiers(const Keys &k);
+
+#endif
@@ -0,0 +1,90 @@
+/* macro.cpp, keys that type a whole string for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// A macro key pressed while a string is still going out is ignored, so a
+// held down or bouncing key can't stack them up.  Typematic repeats never
+// get here, and the string doesn't repeat either.
+
+#include "macro.h"
+#include "tvi_xlat.h"
+#include "tviq.h"
+
+#ifdef MACROS
+
+struct Macro {
+	byte key;
+	byte mods;			// MK_
+	const char *text;
+};
+
+// Logging in, and function key programs for the terminal's FUNCT key
+static const char login[] PROGMEM = "guest\r";
+static const char funct12[] PROGMEM = MS_FUNCT "1" MS_FUNCT "2";
+
+static const Macro macros[] PROGMEM = {
+	{ 0x05, MK_CTRL|MK_ALT, login },	// F1
+	{ 0x06, MK_CTRL|MK_ALT, funct12 },	// F2
+};
+
+#define NMACROS	(sizeof(macros) / sizeof(macros[0]))
+
+static const char *playing;		// Next byte to go out, or NULL
+
+bool macro_start(byte key, byte mods) {
+	byte want = 0, i;
+
+	if (mods & (MOD_LSHIFT|MOD_RSHIFT))
+		want |= MK_SHIFT;
+	if (mods & (MOD_LCTRL|MOD_RCTRL))
+		want |= MK_CTRL;
+	if (mods & (MOD_LALT|MOD_RALT))
+		want |= MK_ALT;
+	for (i=0; i<NMACROS; i++) {
+		if (pgm_read_byte(&macros[i].key) == key && pgm_read_byte(&macros[i].mods) == want) {
+			if (!playing)
+				playing = (const char *)pgm_read_ptr(&macros[i].text);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Called from loop(), tops the line up with the next frames of the string
+void macro_pump(TviQueue &q) {
+	byte c, status = 0;
+	uint16_t f;
+
+	while (playing && tviq_backlog(q) < MACRO_AHEAD) {
+		c = pgm_read_byte(playing++);
+		if (!c) {
+			playing = NULL;
+		} else if (c >= 0xC0) {
+			status |= c << 4;
+		} else {
+			if (c >= 0x80)
+				f = xlat(status & XLAT_MODS, c) | (status & TVI_FUNCT) << 8;
+			else
+				f = pgm_read_word(&xlat_ascii[c]) | status << 8;
+			tviq_put(q, f >> 8, f & 0xFF, false);
+			status = 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,65 @@
+/* macro.h, keys that type a whole string for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// A macro is a key, numbered as in keys.h, the modifiers held with it, and
+// a string in flash.  Pressing it queues the string instead of the key's
+// own frame, and the string then goes out a frame at a time whenever fewer
+// than MACRO_AHEAD bytes are waiting for the line, so it streams at the
+// line's pace and keys typed meanwhile get in between its frames.  The
+// bytes of the string are:
+//
+//	00 - 7F		ASCII, sent as the key that types it, see xlat_ascii
+//	80 - BF		a keycode from PS2_TVI.h, like KEY_F1
+//	C0 - CF		0xC0 | status >> 4, to add TVI_SHIFT, TVI_CTRL or
+//			TVI_FUNCT to the next one, see the MS_ strings
+//
+// The macros themselves are the table in macro.cpp.
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+#include "tviq.h"
+
+// Define to have the keys in macro.cpp type their strings
+// #define MACROS
+
+#define MACRO_AHEAD	4	// Bytes waiting for the line, two frames
+
+// Modifiers a macro key is held with; left and right are the same
+#define MK_SHIFT	1
+#define MK_CTRL		2
+#define MK_ALT		4
+
+// Status prefixes, as strings to paste into a macro's.  Mind that C reads
+// "\x80" "1" as two bytes but "\x801" as one.
+#define MS_SHIFT	"\xC2"
+#define MS_CTRL		"\xC4"
+#define MS_FUNCT	"\xC8"
+
+#ifdef MACROS
+bool macro_start(byte key, byte mods);	// True if key with mods (MOD_) has one
+void macro_pump(TviQueue &q);
+#else
+static inline bool macro_start(byte, byte) { return false; }
+static inline void macro_pump(TviQueue &) {}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/* paste.cpp, typing text from a PC into the terminal for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "paste.h"
+
+#ifdef PASTE
+
+#ifdef ARDUINO
+#include <SoftwareSerial.h>
+#endif
+#include "tvi_xlat.h"
+#include "tviq.h"
+#include "ps2cmd.h"
+
+static SoftwareSerial port(PASTE_RX_PIN, PASTE_TX_PIN);
+
+static bool active;			// Text came in since the last report
+static bool stopped;			// PASTE_CTS_PIN is high
+static byte last;			// The character before
+static unsigned int chars, overruns;
+static unsigned long started, lastIn, lastOut;	// millis(), lastOut the line emptying
+#if PASTE_CPS
+static unsigned long nextOut;		// micros()
+#endif
+
+void paste_begin(void) {
+	port.begin(PASTE_BAUD);
+	digitalWrite(PASTE_CTS_PIN, LOW);
+	pinMode(PASTE_CTS_PIN, OUTPUT);
+}
+
+static void putNumber(unsigned int n, const char *after) {
+	char buf[6];
+	byte i = sizeof(buf);
+
+	do {
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	while (i < sizeof(buf))
+		port.write(buf[i++]);
+	while (*after)
+		port.write(*after++);
+}
+
+// The keyboard is still held off, so blocking on the bit banged port is
+// safe here
+static void report(void) {
+	unsigned long ms = lastOut - started;
+
+	port.write('\r');
+	port.write('\n');
+	putNumber(chars, " chars, ");
+	putNumber(ms ? chars * 1000UL / ms : chars, " cps");
+	if (overruns)
+		putNumber(overruns, " overruns");
+	port.write('\r');
+	port.write('\n');
+}
+
+// Called from loop(), types what the line has room for
+void paste_poll(TviQueue &q) {
+	int c, waiting;
+	uint16_t f;
+
+	waiting = port.available();
+	if (port.overflow())
+		overruns++;
+	if (waiting >= PASTE_HIGH && !stopped) {
+		digitalWrite(PASTE_CTS_PIN, HIGH);
+		stopped = true;
+	} else if (waiting <= PASTE_LOW && stopped) {
+		digitalWrite(PASTE_CTS_PIN, LOW);
+		stopped = false;
+	}
+
+	while (waiting && tviq_backlog(q) < PASTE_AHEAD) {
+#		if PASTE_CPS
+		if ((long)(micros() - nextOut) < 0)
+			break;
+		nextOut = micros() + 1000000UL / PASTE_CPS;
+#		endif
+		c = port.read();
+		waiting--;
+		if (!active) {
+			active = true;
+			chars = overruns = 0;
+			started = millis();
+			ps2cmd_inhibit(true);
+		}
+		lastIn = millis();
+		if (c >= 0x80 || (c == '\n' && last == '\r')) {
+			last = c;
+			continue;
+		}
+		last = c;
+		f = pgm_read_word(&xlat_ascii[c]);
+		tviq_put(q, f >> 8, f & 0xFF, false);
+		chars++;
+	}
+
+	if (active && tviq_backlog(q))
+		lastOut = millis();
+	if (active && !waiting && !tviq_backlog(q) && millis() - lastIn > PASTE_IDLE_MS) {
+		report();
+		active = false;
+		ps2cmd_inhibit(false);
+	}
+}
+
+#endif
@@ -0,0 +1,58 @@
+/* paste.h, typing text from a PC into the terminal for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// With PASTE defined, text sent by a PC to a second serial port, on
+// PASTE_RX_PIN, is typed into the terminal as if on the keyboard, a frame
+// per character from xlat_ascii.  CR LF is one Return; other bytes outside
+// ASCII are skipped.  Frames go out as fast as the terminal line takes
+// them, or PASTE_CPS if that's lower, and PASTE_CTS_PIN tells the PC to
+// wait whenever PASTE_HIGH bytes are waiting, so nothing is dropped.  Wire
+// it to CTS on the PC's serial adapter and turn on RTS/CTS flow control.
+//
+// While text is coming in the keyboard is held off the wire: SoftwareSerial
+// keeps interrupts off for each byte it receives, which would garble the
+// keyboard's.  It keeps what's typed until the paste is over.  Once nothing
+// has come in for PASTE_IDLE_MS, the PC gets a line back saying how many
+// characters went out and how fast, and of any overruns.
+
+#ifndef PASTE_H
+#define PASTE_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+#include "tviq.h"
+
+// #define PASTE
+
+#define PASTE_BAUD	19200
+#define PASTE_HIGH	32	// Bytes waiting that stop the PC,
+#define PASTE_LOW	8	// and let it go again
+#define PASTE_AHEAD	4	// Bytes waiting for the terminal line, two frames
+#define PASTE_CPS	0	// Most characters a second, 0 for the line's rate
+#define PASTE_IDLE_MS	500	// A gap this long ends the paste
+
+#ifdef PASTE
+void paste_begin(void);
+void paste_poll(TviQueue &q);
+#else
+static inline void paste_begin(void) {}
+static inline void paste_poll(TviQueue &) {}
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+/* ps2cmd.cpp, interrupt driven host-to-keyboard commands for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Commands go out one byte at a time.  For each byte we hold the clock low
+// for PS2CMD_RTS_US, take the clock interrupt away from ps2rx.cpp, and let
+// txClock() put a bit on the data line at every falling edge the keyboard
+// makes.  The same handler then reads the keyboard's answer (0xFA or 0xFE)
+// and pulls the clock low again so nothing else can be sent until
+// ps2cmd_poll() decides what comes next.  Nothing here ever waits on the
+// wire, so keystrokes, millis() and the UART keep running throughout.
+//
+// Between commands ps2rx.cpp gets the clock interrupt back.  A command
+// only starts with the primary's ring empty, checked with interrupts off
+// up to the clock being pulled low, so every byte after its ACK is an
+// answer and not a keystroke loop() left behind with the terminal's queue
+// full.  A resend goes out regardless, its answer lands behind them.
+// F0 00 is answered with the set number after the ACK, as a byte of its
+// own, so nothing more goes out until ps2cmd_answered() or PS2CMD_TIMEOUT.
+// ps2cmd_asked() says the next byte off the wire is that answer.
+//
+// ps2cmd_resend() asks for a byte ps2rx.cpp got bad again, first thing.
+// The answer is the byte itself instead of an ACK, and goes into ps2rx.cpp's
+// ring; if it never comes right the byte is lost, see ps2rx.h.
+//
+// ps2cmd_inhibit() keeps the clock low once the command in flight is done,
+// which a keyboard takes as wait, keeping what's typed until it's let go.
+// Commands queued meanwhile go out after that.
+
+#include "ps2cmd.h"
+#include "fastpin.h"
+#include "PS2_TVI.h"
+#include "stats.h"
+#include "trace.h"
+#include "ps2rx.h"
+
+enum { TX_IDLE, TX_RTS, TX_SEND, TX_REPLY, TX_DONE };
+
+struct Ps2Cmd {
+	byte cmd;
+	byte arg;
+	byte len;
+};
+
+static Ps2Cmd queue[PS2CMD_QUEUE];
+static byte qhead, qcount;		// queue[qhead] is the command in flight
+
+// The lines, fixed at compile time so each access is one instruction
+typedef FastPin<PS2CLOCK_PIN> Clk;
+typedef FastPin<PS2DATA_PIN> Data;
+
+static volatile byte txState = TX_IDLE;
+static volatile byte txByte;		// Bits still to go out, or coming in
+static volatile byte txBit;
+static volatile byte txParity;
+static volatile byte txReply;		// The keyboard's answer, or 0 on a bad frame
+static byte txPos;			// Which byte of the command is on the wire
+static byte txTries;
+static unsigned long txStart;		// millis() when the byte was started
+static unsigned long rtsStart;		// micros() when the clock was pulled low
+static bool holding;			// For the answer to F0 00, since txStart
+static bool inhibit, inhibited;		// Wanted, and the clock is low for it
+
+unsigned int ps2cmd_resends;
+unsigned int ps2cmd_failures;
+
+// Falling edge of the keyboard clock while we own the line
+HAL_TIMED static void txClock(void) {
+	byte bit;
+
+	txBit++;
+	if (txState == TX_SEND) {
+		if (txBit <= 8) {		// Data bits 0 - 7
+			bit = txByte & 1;
+			txByte >>= 1;
+			txParity ^= bit;
+			Data::write(bit);
+		} else if (txBit == 9) {	// Parity bit
+			Data::write(txParity);
+		} else if (txBit == 10) {	// Stop bit
+			Data::release();
+		} else {			// ACK bit, then wait for the answer
+			txState = Data::read() ? TX_DONE : TX_REPLY;
+			txReply = 0;
+			txBit = 0;
+			txParity = 0;
+		}
+	} else if (txState == TX_REPLY) {
+		bit = Data::read();
+		if (txBit == 1) {		// Start bit
+			if (bit)
+				txState = TX_DONE;
+		} else if (txBit <= 9) {	// Data bits 0 - 7
+			txParity ^= bit;
+			txByte = (txByte >> 1) | (bit << 7);
+		} else if (txBit == 10) {	// Parity bit
+			txParity ^= bit;
+		} else {			// Stop bit
+			if (bit && txParity)
+				txReply = txByte;
+			else
+				stats_count(STAT_PARITY);
+			txState = TX_DONE;
+		}
+	}
+
+	if (txState == TX_DONE) {
+		// Inhibit the keyboard until ps2cmd_poll() gets to us
+		detachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN));
+		Clk::write(LOW);
+		Clk::output();
+	}
+}
+
+// Pull the clock low to start sending the current byte
+static void beginByte(void) {
+	detachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN));
+	Clk::write(LOW);
+	Clk::output();
+	rtsStart = micros();
+	txStart = millis();
+	txState = TX_RTS;
+}
+
+// Done with the command at the head of the queue, give the line back
+static void endCmd(void) {
+	detachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN));
+	Data::release();
+	Clk::release();
+	ps2rx_attach();
+	txState = TX_IDLE;
+	qhead = (qhead + 1) % PS2CMD_QUEUE;
+	qcount--;
+}
+
+// Try the current byte again, or drop the command if it's out of chances
+static void retryByte(void) {
+	if (++txTries > PS2CMD_RETRIES) {
+		ps2cmd_failures++;
+		if (queue[qhead].cmd == PS2_RESEND)
+			ps2rx_primary->errors |= PS2RX_LOST;	// Its handler is detached
+		endCmd();
+	} else {
+		ps2cmd_resends++;
+		beginByte();
+	}
+}
+
+void ps2cmd_begin(void) {
+	Data::release();
+}
+
+bool ps2cmd_send(byte cmd) {
+	if (qcount == PS2CMD_QUEUE)
+		return false;
+	Ps2Cmd &c = queue[(qhead + qcount) % PS2CMD_QUEUE];
+	c.cmd = cmd;
+	c.arg = 0;
+	c.len = 1;
+	qcount++;
+	return true;
+}
+
+bool ps2cmd_send(byte cmd, byte arg) {
+	if (!ps2cmd_send(cmd))
+		return false;
+	queue[(qhead + qcount - 1) % PS2CMD_QUEUE].arg = arg;
+	queue[(qhead + qcount - 1) % PS2CMD_QUEUE].len = 2;
+	return true;
+}
+
+// Between commands, ahead of whatever is queued.  ps2rx.cpp is holding the
+// keyboard off meanwhile.
+bool ps2cmd_resend(void) {
+	if (qcount == PS2CMD_QUEUE || txState != TX_IDLE)
+		return false;
+	qhead = (qhead + PS2CMD_QUEUE - 1) % PS2CMD_QUEUE;
+	queue[qhead].cmd = PS2_RESEND;
+	queue[qhead].len = 1;
+	qcount++;
+	return true;
+}
+
+// Queue an LED update, or fold it into one that hasn't gone out yet
+void ps2cmd_setLEDs(byte leds) {
+	byte i;
+
+	for (i = (txState == TX_IDLE) ? 0 : 1; i < qcount; i++) {
+		Ps2Cmd &c = queue[(qhead + i) % PS2CMD_QUEUE];
+		if (c.cmd == PS2_CMD_LEDS) {
+			c.arg = leds;
+			return;
+		}
+	}
+	ps2cmd_send(PS2_CMD_LEDS, leds);
+}
+
+void ps2cmd_inhibit(bool on) {
+	inhibit = on;
+}
+
+bool ps2cmd_asked(void) {
+	return holding;
+}
+
+void ps2cmd_answered(void) {
+	holding = false;
+}
+
+bool ps2cmd_idle(void) {
+	return qcount == 0;
+}
+
+// Called from loop(), after it's drained what it can of the primary's ring
+HAL_TIMED void ps2cmd_poll(void) {
+	Ps2Cmd &c = queue[qhead];
+
+	switch (txState) {
+		case TX_IDLE:
+			if (inhibit != inhibited) {
+				detachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN));
+				if (inhibit) {
+					Clk::write(LOW);
+					Clk::output();
+				} else {
+					Clk::release();
+					ps2rx_attach();
+				}
+				inhibited = inhibit;
+			}
+			if (inhibit || !qcount || (holding && c.cmd != PS2_RESEND
+					&& millis() - txStart <= PS2CMD_TIMEOUT))
+				return;
+			noInterrupts();
+			if (c.cmd != PS2_RESEND && !ps2rx_empty(*ps2rx_primary)) {
+				interrupts();
+				return;
+			}
+			if (c.cmd != PS2_RESEND)
+				holding = false;	// It may be the answer coming again
+			txPos = 0;
+			txTries = 0;
+			beginByte();
+			interrupts();
+			break;
+		case TX_RTS:
+			if (micros() - rtsStart < PS2CMD_RTS_US)
+				return;
+			// Start bit, then release the clock for the keyboard to drive
+			txByte = txPos ? c.arg : c.cmd;
+			txBit = 0;
+			txParity = 1;
+			Data::write(LOW);
+			Data::output();
+			txState = TX_SEND;
+			hal_clearPendingIrq(PS2CLOCK_PIN);
+			attachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN), txClock, FALLING);
+			Clk::release();
+			break;
+		case TX_DONE:
+			trace_put(TR_CMD, txPos ? c.arg : c.cmd, txReply);
+			if (c.cmd == PS2_RESEND) {
+				// Answered with the byte, 0 if it came in bad again
+				if (txReply && txReply != PS2_RESEND) {
+					ps2rx_put(*ps2rx_primary, txReply);
+					endCmd();
+				} else {
+					retryByte();
+				}
+			} else if (txReply == PS2_ACK) {
+				txTries = 0;
+				if (++txPos < c.len) {
+					beginByte();
+				} else {
+					holding = c.cmd == PS2_CMD_SCANSET && !c.arg;
+					txStart = millis();
+					endCmd();
+				}
+			} else {
+				retryByte();
+			}
+			break;
+		default:
+			if (millis() - txStart > PS2CMD_TIMEOUT) {
+				detachInterrupt(digitalPinToInterrupt(PS2CLOCK_PIN));
+				Data::release();
+				retryByte();
+			}
+			break;
+	}
+}
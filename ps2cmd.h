@@ -0,0 +1,57 @@
+/* ps2cmd.h, interrupt driven host-to-keyboard commands for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PS2CMD_H
+#define PS2CMD_H
+
+#include "hal.h"
+
+#define PS2CMD_QUEUE	6	// Commands waiting, counting the one in flight
+#define PS2CMD_RETRIES	3	// Resends or timeouts before giving up on one
+#define PS2CMD_TIMEOUT	25	// ms for a byte to be clocked out and answered
+#define PS2CMD_RTS_US	100	// How long to hold the clock low before sending
+
+#define PS2_CMD_LEDS	0xED
+#define PS2_CMD_SCANSET	0xF0	// Select a scan code set, or 0 to ask which
+#define PS2_CMD_TYPEMATIC	0xF3
+#define PS2_CMD_ENABLE	0xF4
+#define PS2_CMD_ALL_MAKEBREAK	0xF8	// Set 3: no key repeats
+#define PS2_CMD_KEY_MAKEONLY	0xFD	// Set 3: these keys send no break
+#define PS2_CMD_RESET	0xFF
+#define PS2_ACK		0xFA
+#define PS2_RESEND	0xFE
+#define PS2_BAT_OK	0xAA
+#define PS2_BAT_FAIL	0xFC	// Self test failed
+#define PS2_OVERRUN	0xFF	// Keyboard lost keystrokes
+
+void ps2cmd_begin(void);		// On PS2CLOCK_PIN and PS2DATA_PIN
+bool ps2cmd_send(byte cmd);
+bool ps2cmd_send(byte cmd, byte arg);
+bool ps2cmd_resend(void);		// Ask for the byte that came in bad again
+void ps2cmd_setLEDs(byte leds);
+void ps2cmd_poll(void);
+bool ps2cmd_idle(void);
+bool ps2cmd_asked(void);		// F0 00 was acknowledged, its answer is next
+void ps2cmd_answered(void);		// The byte after asking for the scan code set is in
+void ps2cmd_inhibit(bool on);		// Hold the clock low between commands
+
+extern unsigned int ps2cmd_resends;	// Bytes sent again after 0xFE or a timeout
+extern unsigned int ps2cmd_failures;	// Commands dropped after PS2CMD_RETRIES
+
+#endif
@@ -0,0 +1,237 @@
+/* ps2rx.cpp, reads each keyboard's bytes off its PS/2 lines
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// See ps2rx.h.  The primary's handler goes through attachInterrupt() rather
+// than an ISR() of its own, since ps2cmd.cpp swaps in txClock() the same way
+// and the core's WInterrupts.c already owns the vectors.  On the board the
+// other channels' clocks have no INTn pins left, so they share port K's pin
+// change interrupt below.  There's one handler per channel, made from a
+// template, so each reads its data pin with FastPin; the rest is shared and
+// takes the channel's Ps2Rx.
+
+#include "ps2rx.h"
+#include "fastpin.h"
+#include "PS2_TVI.h"
+#include "stats.h"
+#include "ps2cmd.h"
+
+Ps2Rx *ps2rx_primary;
+volatile unsigned int ps2rx_framing;
+volatile unsigned int ps2rx_overruns;
+
+static Ps2Rx *rxs[CHANNELS];
+
+static constexpr byte chClock[] = CH_CLOCK_PINS;
+static constexpr byte chData[] = CH_DATA_PINS;
+static_assert(CHANNELS - 1 <= sizeof(chClock), "More CHANNELS than PS2_TVI.h has pins for");
+
+static constexpr byte clockPin(byte ch) {
+	return ch ? chClock[ch-1] : PS2CLOCK_PIN;
+}
+
+static constexpr byte dataPin(byte ch) {
+	return ch ? chData[ch-1] : PS2DATA_PIN;
+}
+
+// Inhibit the keyboard until ps2rx_poll() lets it go.  Rare enough to go
+// through digitalWrite() and pinMode() with the pin in r.
+static void hold(Ps2Rx &r) {
+	digitalWrite(r.clk, LOW);
+	pinMode(r.clk, OUTPUT);
+	r.held = true;
+}
+
+static void bad(Ps2Rx &r) {
+	r.errors |= PS2RX_BAD;
+	hold(r);
+}
+
+// From the interrupt, or from ps2cmd.cpp while that's detached
+void ps2rx_put(Ps2Rx &r, byte c) {
+	byte h = r.head, next = (h + 1) & (PS2RX_SIZE-1);
+
+	if (next == r.tail) {
+		ps2rx_overruns++;
+		r.errors |= PS2RX_LOST;
+		return;
+	}
+	r.buf[h] = c;
+	r.head = next;
+	hal_ps2Put(r.ch);
+	if (((r.tail - next - 1) & (PS2RX_SIZE-1)) < PS2RX_ROOM)
+		hold(r);
+}
+
+// Falling edge of a keyboard clock while it's ours to read, with the bit
+// on its data line
+HAL_TIMED static void rxBit(Ps2Rx &r, byte bit) {
+	unsigned long now;
+
+	if (r.held)			// Our own edge, from hold()
+		return;
+	now = millis();
+	if (now - r.lastEdge > PS2RX_GAP_MS)
+		r.bitNum = 0;
+	r.lastEdge = now;
+	if (r.bitNum == 0) {			// Start bit must be 0
+		if (bit) {
+			ps2rx_framing++;
+			bad(r);
+			return;
+		}
+		r.incoming = 0;
+		r.parity = 1;
+	} else if (r.bitNum <= 8) {		// Data bits 0 - 7
+		r.incoming = (r.incoming >> 1) | (bit << 7);
+		r.parity ^= bit;
+	} else if (r.bitNum == 9) {		// Parity bit
+		r.parity ^= bit;
+	} else {				// Stop bit
+		r.bitNum = 0;
+		if (!bit) {
+			ps2rx_framing++;
+			bad(r);
+		} else if (r.parity) {
+			stats_count(STAT_PARITY);
+			bad(r);
+		} else {
+			// Sets 2 and 3 say overrun with 00, which ps2rx_read() can't
+			// return, so it goes in as set 1's
+			ps2rx_put(r, r.incoming ? r.incoming : PS2_OVERRUN);
+		}
+		return;
+	}
+	r.bitNum++;
+}
+
+template <byte CH>
+static void rxClock(void) {
+	rxBit(*rxs[CH], FastPin<dataPin(CH)>::read());
+}
+
+static void (* const handlers[])(void) = {
+	rxClock<0>,
+#if CHANNELS > 1
+	rxClock<1>,
+#endif
+#if CHANNELS > 2
+	rxClock<2>,
+#endif
+#if CHANNELS > 3
+	rxClock<3>,
+#endif
+};
+static_assert(sizeof(handlers) / sizeof(handlers[0]) == CHANNELS, "A handler for every channel");
+
+#if CHANNELS > 1 && defined(ARDUINO)
+// Pin change interrupts come on either edge of any pin in the group, so
+// keep which clocks were low to tell the ones that just fell.  Our own
+// edges from hold() get here too, and rxBit() drops them.
+static constexpr bool onPortK(byte i) {
+	return i >= CHANNELS - 1 || (digitalPinToPCICRbit(chClock[i]) == 2 && onPortK(i + 1));
+}
+static_assert(onPortK(0), "The other channels' clocks must all be on PCINT16 - 23");
+
+static byte pcLow;
+
+static inline bool fell(byte now, byte ch) {
+	return now & bit(digitalPinToPCMSKbit(clockPin(ch)));
+}
+
+ISR(PCINT2_vect) {
+	byte low = ~PINK & PCMSK2, now = low & ~pcLow;
+
+	pcLow = low;
+	if (fell(now, 1))
+		rxClock<1>();
+#	if CHANNELS > 2
+	if (fell(now, 2))
+		rxClock<2>();
+#	endif
+#	if CHANNELS > 3
+	if (fell(now, 3))
+		rxClock<3>();
+#	endif
+}
+
+static void pcAttach(byte pin) {
+	byte b = bit(digitalPinToPCMSKbit(pin));
+
+	noInterrupts();
+	if (!(PINK & b))
+		pcLow |= b;
+	PCMSK2 |= b;
+	PCIFR = bit(PCIF2);
+	PCICR |= bit(PCIE2);
+	interrupts();
+}
+#endif
+
+// With the clock released, unless we're still holding the keyboard off
+static void attach(Ps2Rx &r) {
+	r.bitNum = 0;
+	if (r.held)
+		hold(r);
+#if CHANNELS > 1 && defined(ARDUINO)
+	if (r.ch) {
+		pcAttach(r.clk);
+		return;
+	}
+#endif
+	hal_clearPendingIrq(r.clk);
+	attachInterrupt(digitalPinToInterrupt(r.clk), handlers[r.ch], FALLING);
+}
+
+void ps2rx_begin(Ps2Rx &r, byte ch) {
+	if (ch >= CHANNELS)
+		return;
+	r.head = r.tail = 0;
+	r.errors = 0;
+	r.held = false;
+	r.ch = ch;
+	r.clk = clockPin(ch);
+	rxs[ch] = &r;
+	if (!ch)
+		ps2rx_primary = &r;
+	hal_ps2Begin(ch, r.clk, dataPin(ch));
+	pinMode(dataPin(ch), INPUT_PULLUP);
+	pinMode(r.clk, INPUT_PULLUP);
+	attach(r);
+}
+
+void ps2rx_attach(void) {
+	attach(*ps2rx_primary);
+}
+
+// Called from loop() once it's read what it can: the errors since last
+// time, and the keyboard let go if they're dealt with and there's room
+byte ps2rx_poll(Ps2Rx &r) {
+	byte e;
+
+	noInterrupts();
+	e = r.errors;
+	r.errors = 0;
+	interrupts();
+	if (r.held && !e && (r.ch || ps2cmd_idle())
+			&& ((r.head - r.tail) & (PS2RX_SIZE-1)) < PS2RX_SIZE/2) {
+		r.held = false;
+		pinMode(r.clk, INPUT_PULLUP);
+	}
+	return e;
+}
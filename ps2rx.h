@@ -0,0 +1,104 @@
+/* ps2rx.h, reads each keyboard's bytes off its PS/2 lines
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Every converter has a Ps2Rx for its keyboard, see converter.h.  Its
+// clock interrupt takes one bit at each falling edge, reading the data line
+// with FastPin, and checks the start, parity and stop bits the way
+// readByte() in PS2_TVI.cpp does.  Good bytes go into the converter's ring,
+// which loop() empties with ps2rx_read().  Only the interrupt moves the
+// head and only loop() the tail, each with a single byte store, so neither
+// side ever turns interrupts off for the other.  Channel 0, the primary, is
+// on PS2CLOCK_PIN and PS2DATA_PIN, and channel n on the n'th of
+// CH_CLOCK_PINS and CH_DATA_PINS, see PS2_TVI.h.
+//
+// A bad frame is counted in STAT_PARITY or STAT_RXFRAME, and the clock is
+// held low at once so the keyboard keeps what it types next.  loop() finds
+// PS2RX_BAD in ps2rx_poll() and, for the primary, has ps2cmd.cpp ask for
+// the byte again (0xFE), ahead of anything else; its answer goes into the
+// ring in order.  The other keyboards aren't sent commands, so their bad
+// bytes are lost.  A frame that stops half way, because the keyboard was
+// inhibited or unplugged, is given up on when the next edge comes more than
+// PS2RX_GAP_MS later.
+//
+// With fewer than PS2RX_ROOM places left in a ring the clock is held low
+// too, and what's typed meanwhile waits in the keyboard's own buffer.  A
+// byte that still finds the ring full, or a resend that never comes, is
+// lost for good: it's counted in STAT_RXOVER or as a command failure, and
+// PS2RX_LOST tells loop() to start over as the keyboard's overrun code does.
+// ps2rx_poll() lets the keyboard go on once there's room again and nothing
+// is waiting to be sent to it.
+//
+// ps2cmd.cpp takes the primary's clock interrupt away while it sends a
+// command, and gives it back with ps2rx_attach().
+
+#ifndef PS2RX_H
+#define PS2RX_H
+
+#include "hal.h"
+
+#define PS2RX_SIZE	32		// Bytes, a power of two
+#define PS2RX_GAP_MS	2		// Longest pause inside a frame
+#define PS2RX_ROOM	4		// Hold the keyboard off with less room left
+
+// ps2rx_poll()
+#define PS2RX_BAD	1		// A frame came in bad, ask for it again
+#define PS2RX_LOST	2		// A byte is gone for good
+
+struct Ps2Rx {
+	volatile byte buf[PS2RX_SIZE];
+	volatile byte head;		// Next to fill, the interrupt's
+	volatile byte tail;		// Next to read, loop()'s
+	volatile byte errors;		// PS2RX_ since ps2rx_poll()
+	volatile bool held;		// We have the clock low, not ps2cmd.cpp
+	byte ch;			// Which keyboard
+	byte clk;			// and its clock pin
+	// Only touched by its interrupt, or while that's detached
+	byte bitNum;			// 0 start, 1 - 8 data, 9 parity, 10 stop
+	byte incoming;
+	byte parity;
+	unsigned long lastEdge;
+};
+
+extern Ps2Rx *ps2rx_primary;		// converters[0]'s, which ps2cmd.cpp shares
+extern volatile unsigned int ps2rx_framing;	// Bad start or stop bits, all keyboards
+extern volatile unsigned int ps2rx_overruns;	// Dropped with a ring full
+
+void ps2rx_begin(Ps2Rx &r, byte ch);	// On channel ch's pins, see above
+void ps2rx_attach(void);		// Take the primary's clock interrupt back
+void ps2rx_put(Ps2Rx &r, byte c);	// A byte in by other means, the resent one
+byte ps2rx_poll(Ps2Rx &r);		// After draining the ring, see above
+
+// The oldest byte in the ring, or 0 if there's none
+static inline byte ps2rx_read(Ps2Rx &r) {
+	byte t = r.tail, c;
+
+	if (t == r.head)
+		return 0;
+	c = r.buf[t];
+	r.tail = (t + 1) & (PS2RX_SIZE-1);
+	hal_ps2Taken(r.ch);
+	return c;
+}
+
+// Nothing waiting for loop(), which only the interrupt can change
+static inline bool ps2rx_empty(const Ps2Rx &r) {
+	return r.head == r.tail;
+}
+
+#endif
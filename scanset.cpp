@@ -0,0 +1,83 @@
+/* scanset.cpp, picks the scan code set after each keyboard reset
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// With DECODE_SET3, every time the keyboard passes its self test we ask it
+// for set 3 and then which set it's in, since some keyboards acknowledge
+// the switch and stay in set 2.  The answer comes back as the first byte
+// after the keyboard acknowledges F0 00, which scanset_answer() picks out;
+// anything else, codes 01 - 03 included, is a keystroke.  In set 3 the keyboard
+// is told not to repeat any key, we make our own repeats, and not to send
+// breaks for the lock keys.  Set 3 saves the E0 and E1 prefixes, so most
+// keys are 1 byte down and 2 up against 2 and 3, and Pause is 1 not 8.
+//
+// Keyboards without set 3, or no answer within SCANSET_TIMEOUT, leave us
+// in set 2, set up as without DECODE_SET3.
+
+#include "scanset.h"
+
+#ifdef DECODE_SET3
+
+static Decoder *dec;
+static bool asking;			// Waiting to hear which set
+static unsigned long askedAt;
+
+void scanset_begin(Decoder &d) {
+	dec = &d;
+	decode_set3(d, false);		// Every reset goes back to set 2
+	ps2cmd_send(PS2_CMD_SCANSET, 3);
+	ps2cmd_send(PS2_CMD_SCANSET, 0);
+	asking = true;
+	askedAt = millis();
+}
+
+static void useSet2(void) {
+	ps2cmd_send(PS2_CMD_TYPEMATIC, TYPEMATIC_KBD);
+}
+
+static void useSet3(void) {
+	decode_set3(*dec, true);
+	ps2cmd_send(PS2_CMD_ALL_MAKEBREAK);
+	ps2cmd_send(PS2_CMD_KEY_MAKEONLY, S3_CLOCK);
+	ps2cmd_send(PS2_CMD_KEY_MAKEONLY, S3_NLOCK);
+	ps2cmd_send(PS2_CMD_ENABLE);	// Which also ends the list of keys
+}
+
+// True if c was the keyboard saying which set it's in
+bool scanset_answer(byte c) {
+	if (!asking || !ps2cmd_asked())
+		return false;
+	ps2cmd_answered();		// Whatever it was, it was the answer's turn
+	if (c < 1 || c > 3)
+		return false;
+	asking = false;
+	if (c == 3)
+		useSet3();
+	else
+		useSet2();
+	return true;
+}
+
+void scanset_poll(void) {
+	if (asking && millis() - askedAt > SCANSET_TIMEOUT) {
+		asking = false;
+		useSet2();
+	}
+}
+
+#endif
@@ -0,0 +1,44 @@
+/* scanset.h, picks the scan code set after each keyboard reset
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SCANSET_H
+#define SCANSET_H
+
+#include "hal.h"
+#include "ps2cmd.h"
+#include "decode.h"
+#include "typematic.h"
+
+#define SCANSET_TIMEOUT	100	// ms to wait for the keyboard to say which set
+
+// The keyboard on ps2cmd.cpp's pins, whose bytes go through d
+#ifdef DECODE_SET3
+void scanset_begin(Decoder &d);
+bool scanset_answer(byte c);
+void scanset_poll(void);
+#else
+// Set 2 as it comes, with its typematic slowed down
+static inline void scanset_begin(Decoder &) {
+	ps2cmd_send(PS2_CMD_TYPEMATIC, TYPEMATIC_KBD);
+}
+static inline bool scanset_answer(byte) { return false; }
+static inline void scanset_poll(void) {}
+#endif
+
+#endif
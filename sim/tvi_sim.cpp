@@ -0,0 +1,536 @@
+/* tvi_sim.cpp, cycle counts of the AVR build of PS2_TVI.cpp under simavr
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Usage: tvi_sim -e elf -m symfile [-b budgetfile] [-s scanfile] [-t ms] [-v]
+//
+// Runs the firmware, as the Arduino build made it, on a simulated 16MHz
+// ATmega328 with a keyboard on the PS/2 pins.  The keyboard answers the
+// reset and every command the way the one in host/hal_linux.cpp does, then
+// plays the scan file (lines of "<time in us> <hex code>", as for tvi_bench
+// -s, timed from the end of its self test), bit by bit on the clock and
+// data lines.  The run ends -t ms after the last scan code.
+//
+// Along the way it counts, in CPU cycles:
+//
+//	each routine in the budget file, from its first instruction to its
+//	return, worst case and average.  Interrupts taken meanwhile count,
+//	time asleep in hal_idle() doesn't, so loop() is one pass of work.
+//	The symbols come from "avr-nm -C -S" of the same ELF (-m).
+//
+//	the longest stretch with interrupts off, and the routine it began in.
+//	ISRs run with interrupts off, so the longest of them shows up here.
+//
+//	the longest the firmware took to put the next bit on the data line
+//	after the keyboard's falling clock edge, when sending to it.  The
+//	keyboard reads it at the rising edge, half a clock period later.
+//
+// Anything over budget is marked and the exit status is 1; so is a routine
+// that was never called, whose budget then says nothing, and a run where no
+// TVI frames came out, which means the stimulus didn't work.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_uart.h"
+#include "../PS2_TVI.h"
+
+#define F_CPU		16000000UL
+#define CYCLES_US	(F_CPU / 1000000UL)
+#define KBD_HALFBIT	(40 * CYCLES_US)	// Half a clock period, as on the host
+#define KBD_TICK	(KBD_HALFBIT / 2)	// Everything the keyboard does is on this grid
+#define KBD_BAT		(400000UL * CYCLES_US)	// Self test time after a reset
+#define KBD_REPLY	(500 * CYCLES_US)	// Command to answer
+#define KBD_GAP		(100 * CYCLES_US)	// Between bytes it sends
+
+// ATmega328 port D, where the PS/2 lines are, in simavr's data space, and
+// the paste port's RX on port B, which has to idle high
+#define SIM_DDRD	0x2A
+#define SIM_PORTD	0x2B
+static_assert(PS2CLOCK_PIN < 8 && PS2DATA_PIN < 8, "tvi_sim expects the PS/2 lines on port D");
+static_assert(PASTE_RX_PIN >= 8 && PASTE_RX_PIN < 14, "tvi_sim expects the paste RX on port B");
+
+static avr_t *avr;
+
+// ---- Symbols and budgets ----
+
+struct Symbol {
+	uint32_t addr, size;
+	std::string name;
+};
+
+static std::vector<Symbol> symbols;
+
+// The routine the byte address pc is in
+static const char *symbolAt(uint32_t pc, uint32_t *offset) {
+	auto s = std::upper_bound(symbols.begin(), symbols.end(), pc,
+		[](uint32_t a, const Symbol &b) { return a < b.addr; });
+
+	if (s == symbols.begin())
+		return "?";
+	--s;
+	*offset = pc - s->addr;
+	return s->name.c_str();
+}
+
+static bool readSymbols(const char *file) {
+	FILE *f = fopen(file, "r");
+	char line[512], type;
+	unsigned addr, size;
+	int n;
+
+	if (!f)
+		return false;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+		if (sscanf(line, "%x %x %c %n", &addr, &size, &type, &n) != 3)
+			continue;
+		if (type != 'T' && type != 't' && type != 'W' && type != 'w')
+			continue;
+		symbols.push_back(Symbol{ addr, size, line + n });
+	}
+	fclose(f);
+	std::sort(symbols.begin(), symbols.end(),
+		[](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+	return true;
+}
+
+// Does the demangled sym name the routine called name?  Template functions
+// come with their return type first, and any function with its arguments.
+static bool nameMatches(const std::string &sym, const std::string &name) {
+	size_t p = sym.find(name);
+	char after;
+
+	if (p == std::string::npos || (p && sym[p-1] != ' '))
+		return false;
+	after = sym.c_str()[p + name.size()];
+	return !after || after == '(' || after == '<';
+}
+
+struct Routine {
+	std::string name;
+	uint32_t addr;
+	uint64_t budget;
+	uint64_t worst, total, calls;
+};
+
+static std::vector<Routine> routines;
+static uint64_t irqOffBudget, bitBudget;
+
+// Lines of "<cycles> <routine>", or irqoff / bitresp for the other two
+static bool readBudget(const char *file) {
+	FILE *f = fopen(file, "r");
+	char line[256], name[200];
+	unsigned long long cycles;
+	bool ok = true;
+
+	if (!f)
+		return false;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llu %199[^\n]", &cycles, name) != 2)
+			continue;	// Comments and blank lines
+		if (!strcmp(name, "irqoff")) {
+			irqOffBudget = cycles;
+			continue;
+		}
+		if (!strcmp(name, "bitresp")) {
+			bitBudget = cycles;
+			continue;
+		}
+		Routine r = { name, 0, cycles, 0, 0, 0 };
+		for (const Symbol &s : symbols)
+			if (nameMatches(s.name, name))
+				r.addr = s.addr;
+		if (!r.addr) {
+			fprintf(stderr, "tvi_sim: %s isn't in the ELF, inlined?\n", name);
+			ok = false;
+		}
+		routines.push_back(r);
+	}
+	fclose(f);
+	return ok;
+}
+
+// ---- The keyboard ----
+
+enum { K_IDLE, K_TX, K_RX };
+
+struct KbdByte {
+	uint8_t code;
+	uint64_t at;			// In cycles
+};
+
+static struct {
+	int mode = K_IDLE;
+	unsigned tick;			// KBD_TICKs into it
+	uint8_t frame[11];		// Being sent, start to stop bit
+	uint16_t rxbits;
+	uint8_t lastSent, argCmd;
+	uint64_t ready = ~0ULL;		// End of the self test
+	uint64_t free;			// Earliest start of the next byte
+	bool clk = true, data = true;	// What it's driving, true is let go
+	std::deque<KbdByte> out;	// The scan file, timed from ready
+	std::deque<KbdByte> reply;	// Answers, which go first
+	avr_irq_t *clkIrq, *dataIrq;
+	uint64_t fell;			// Last falling edge while receiving
+	uint64_t bitWorst;
+	unsigned cmds;
+} kbd;
+
+static bool hostLow(uint8_t pin) {
+	uint8_t bit = 1 << pin;
+
+	return (avr->data[SIM_DDRD] & bit) && !(avr->data[SIM_PORTD] & bit);
+}
+
+static void drive(bool clk, bool data) {
+	if (clk != kbd.clk)
+		avr_raise_irq(kbd.clkIrq, kbd.clk = clk);
+	if (data != kbd.data)
+		avr_raise_irq(kbd.dataIrq, kbd.data = data);
+}
+
+static void reply(uint8_t code, uint64_t at) {
+	kbd.reply.push_back(KbdByte{ code, at });
+}
+
+// Answer a byte from the host, a shorter version of kbdCommand() in
+// host/hal_linux.cpp: no set 3, no NAKs
+static void command(uint8_t c, bool parityOk, uint64_t now) {
+	uint64_t t = now + KBD_REPLY;
+
+	kbd.cmds++;
+	if (now < kbd.ready && kbd.ready != ~0ULL)
+		return;			// Not listening during the self test
+	if (!parityOk) {
+		reply(0xFE, t);
+		return;
+	}
+	if (kbd.argCmd && c < 0xED) {
+		reply(0xFA, t);
+		if (kbd.argCmd == 0xF0 && c == 0)
+			reply(2, t);
+		kbd.argCmd = 0;
+		return;
+	}
+	kbd.argCmd = 0;
+	switch (c) {
+		case 0xED:	// Set LEDs
+		case 0xF3:	// Set typematic rate
+		case 0xF0:	// Select scan code set
+			kbd.argCmd = c;
+			reply(0xFA, t);
+			break;
+		case 0xEE:	// Echo
+			reply(0xEE, t);
+			break;
+		case 0xF2:	// Read ID
+			reply(0xFA, t);
+			reply(0xAB, t);
+			reply(0x83, t);
+			break;
+		case 0xFE:	// Resend
+			reply(kbd.lastSent, t);
+			break;
+		case 0xFF:	// Reset and self test
+			reply(0xFA, t);
+			reply(0xAA, t + KBD_BAT);
+			kbd.ready = t + KBD_BAT;
+			break;
+		default:
+			reply(0xFA, t);
+			break;
+	}
+}
+
+// Every KBD_TICK: move the lines along for the frame in progress, or start one
+static avr_cycle_count_t kbdTick(avr_t *, avr_cycle_count_t now, void *) {
+	unsigned t, i, parity;
+
+	if (kbd.mode == K_TX) {
+		t = ++kbd.tick;
+		if (hostLow(PS2CLOCK_PIN) && t < 4*10) {
+			// Inhibited before the stop bit, send it again later
+			kbd.mode = K_IDLE;
+			kbd.reply.push_front(KbdByte{ kbd.lastSent, now });
+			drive(true, true);
+		} else if (t >= 4*11) {
+			kbd.mode = K_IDLE;
+			kbd.free = now + KBD_GAP;
+			drive(true, true);
+		} else {
+			// Data changes at the start of each bit, the clock is
+			// low for the middle half
+			drive((t & 3) == 0 || (t & 3) == 3, kbd.frame[t / 4]);
+		}
+		return now + KBD_TICK;
+	}
+	if (kbd.mode == K_RX) {
+		t = ++kbd.tick;
+		if (t & 1)
+			return now + KBD_TICK;
+		t /= 2;			// Half bits: even ones fall, odd ones rise
+		if (t < 22 && !(t & 1))
+			kbd.fell = now;
+		if (t < 20 && (t & 1))
+			kbd.rxbits |= (hostLow(PS2DATA_PIN) ? 0 : 1) << (t / 2);
+		if (t >= 22) {
+			kbd.mode = K_IDLE;
+			drive(true, true);
+			parity = 0;
+			for (i=0; i<9; i++)
+				parity ^= (kbd.rxbits >> i) & 1;
+			command(kbd.rxbits & 0xFF, parity == 1 && (kbd.rxbits & 0x200), now);
+			kbd.free = now + KBD_GAP;
+		} else {
+			drive(t & 1, t < 20);	// ACK from the stop bit's rising edge on
+		}
+		return now + KBD_TICK;
+	}
+
+	// Idle: the host asking to send, or something for us to send
+	if (hostLow(PS2CLOCK_PIN))
+		return now + KBD_TICK;
+	if (hostLow(PS2DATA_PIN)) {
+		kbd.mode = K_RX;
+		kbd.tick = 0;
+		kbd.rxbits = 0;
+		kbd.fell = now;
+		drive(false, true);
+		return now + KBD_TICK;
+	}
+	std::deque<KbdByte> &q = kbd.reply.empty() ? kbd.out : kbd.reply;
+	if (q.empty() || now < kbd.free || now < q.front().at
+			|| (&q == &kbd.out && (kbd.ready == ~0ULL || now < kbd.ready)))
+		return now + KBD_TICK;
+	kbd.lastSent = q.front().code;
+	q.pop_front();
+	kbd.mode = K_TX;
+	kbd.tick = 0;
+	parity = 1;
+	kbd.frame[0] = 0;
+	for (i=0; i<8; i++) {
+		kbd.frame[i+1] = (kbd.lastSent >> i) & 1;
+		parity ^= kbd.frame[i+1];
+	}
+	kbd.frame[9] = parity;
+	kbd.frame[10] = 1;
+	drive(true, false);
+	return now + KBD_TICK;
+}
+
+// ---- The terminal ----
+
+static unsigned long txBytes;
+
+static void uartOut(avr_irq_t *, uint32_t, void *) {
+	txBytes++;
+}
+
+// ---- Running ----
+
+struct Frame {
+	Routine *r;
+	uint16_t sp;			// At its first instruction, return address pushed
+	uint64_t start, slept;
+};
+
+static uint16_t sp(void) {
+	return avr->data[R_SPL] | avr->data[R_SPH] << 8;
+}
+
+int main(int argc, char **argv) {
+	const char *elfFile = NULL, *symFile = NULL, *budgetFile = NULL, *scanFile = NULL;
+	unsigned long long at;
+	unsigned code;
+	unsigned long tailMs = 100;
+	bool verbose = false, over = false, irqOff = false, seenSei = false, dataWas = true;
+	int opt;
+	elf_firmware_t fw;
+	std::vector<Frame> stack;
+	uint64_t slept = 0, before, end, offStart = 0, offSlept = 0, offWorst = 0, last = 0;
+	uint32_t pc, offPc = 0, worstPc = 0, offset = 0;
+	uint32_t uartFlags = 0;
+	int state = cpu_Running;
+
+	while ((opt = getopt(argc, argv, "e:m:b:s:t:v")) != -1) {
+		switch (opt) {
+			case 'e': elfFile = optarg; break;
+			case 'm': symFile = optarg; break;
+			case 'b': budgetFile = optarg; break;
+			case 's': scanFile = optarg; break;
+			case 't': tailMs = strtoul(optarg, NULL, 0); break;
+			case 'v': verbose = true; break;
+			default:
+				elfFile = NULL;
+				break;
+		}
+	}
+	if (!elfFile || !symFile) {
+		fprintf(stderr, "usage: %s -e elf -m symfile [-b budgetfile] [-s scanfile] [-t ms] [-v]\n", argv[0]);
+		return 2;
+	}
+	if (!readSymbols(symFile)) {
+		perror(symFile);
+		return 2;
+	}
+	if (budgetFile && !readBudget(budgetFile))
+		over = true;
+	if (scanFile) {
+		FILE *f = fopen(scanFile, "r");
+
+		if (!f) {
+			perror(scanFile);
+			return 2;
+		}
+		while (fscanf(f, "%llu %x", &at, &code) == 2) {
+			kbd.out.push_back(KbdByte{ (uint8_t)code, at * CYCLES_US });
+			last = at * CYCLES_US;
+		}
+		fclose(f);
+	}
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elfFile, &fw)) {
+		fprintf(stderr, "tvi_sim: can't load %s\n", elfFile);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name("atmega328p");
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = F_CPU;		// The Arduino ELF doesn't say
+
+	kbd.clkIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), PS2CLOCK_PIN);
+	kbd.dataIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), PS2DATA_PIN);
+	avr_raise_irq(kbd.clkIrq, 1);
+	avr_raise_irq(kbd.dataIrq, 1);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PASTE_RX_PIN - 8), 1);
+	avr_cycle_timer_register(avr, KBD_TICK, kbdTick, NULL);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+		uartOut, NULL);
+	avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &uartFlags);
+	uartFlags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &uartFlags);
+
+	// The scan file starts once the keyboard is ready, which it is only
+	// after setup() has reset it, so the end moves out then
+	end = ~0ULL;
+	while (state != cpu_Done && state != cpu_Crashed && avr->cycle < end) {
+		if (end == ~0ULL && kbd.ready != ~0ULL) {
+			for (KbdByte &b : kbd.out)
+				b.at += kbd.ready;
+			end = kbd.ready + last + tailMs * 1000 * CYCLES_US;
+		}
+
+		pc = avr->pc;
+		for (Routine &r : routines) {
+			if (r.addr != pc)
+				continue;
+			// Not a jump back to its own start
+			if (stack.empty() || stack.back().r != &r || stack.back().sp != sp())
+				stack.push_back(Frame{ &r, sp(), avr->cycle, slept });
+		}
+
+		before = avr->cycle;
+		bool asleep = avr->state == cpu_Sleeping;
+		state = avr_run(avr);
+		if (asleep)
+			slept += avr->cycle - before;
+
+		while (!stack.empty() && sp() > stack.back().sp) {
+			Frame &f = stack.back();
+			uint64_t c = avr->cycle - f.start - (slept - f.slept);
+
+			f.r->calls++;
+			f.r->total += c;
+			f.r->worst = std::max(f.r->worst, c);
+			stack.pop_back();
+		}
+
+		// Interrupts off, after init() first turns them on
+		if (avr->sreg[S_I]) {
+			if (irqOff && seenSei && avr->cycle - offStart - (slept - offSlept) > offWorst) {
+				offWorst = avr->cycle - offStart - (slept - offSlept);
+				worstPc = offPc;
+			}
+			irqOff = false;
+			seenSei = true;
+		} else if (!irqOff) {
+			irqOff = true;
+			offStart = avr->cycle;
+			offSlept = slept;
+			offPc = pc;
+		}
+
+		// The next data bit going out, after the keyboard's clock fell
+		if (kbd.mode == K_RX && hostLow(PS2DATA_PIN) != !dataWas) {
+			kbd.bitWorst = std::max(kbd.bitWorst, (uint64_t)(avr->cycle - kbd.fell));
+			dataWas = !hostLow(PS2DATA_PIN);
+		} else if (kbd.mode != K_RX) {
+			dataWas = !hostLow(PS2DATA_PIN);
+		}
+	}
+
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "tvi_sim: crashed at %04X (%s+%X)\n", avr->pc,
+			symbolAt(avr->pc, &offset), offset);
+		return 1;
+	}
+
+	printf("simulated         %.1f ms, asleep %.0f%%\n", avr->cycle / (F_CPU / 1000.0),
+		100.0 * slept / avr->cycle);
+	printf("keyboard commands %u\n", kbd.cmds);
+	printf("TVI bytes sent    %lu\n", txBytes);
+	printf("\n%-34s %8s %8s %8s %8s\n", "cycles", "calls", "average", "worst", "budget");
+	for (const Routine &r : routines) {
+		bool bad = !r.calls || r.worst > r.budget;
+
+		printf("%-34s %8llu %8llu %8llu %8llu%s\n", r.name.c_str(),
+			(unsigned long long)r.calls,
+			(unsigned long long)(r.calls ? r.total / r.calls : 0),
+			(unsigned long long)r.worst, (unsigned long long)r.budget,
+			bad ? "  OVER" : r.calls ? "" : "  never called");
+		over |= bad;
+	}
+	printf("%-34s %8s %8s %8llu %8llu%s", "interrupts off", "", "",
+		(unsigned long long)offWorst, (unsigned long long)irqOffBudget,
+		irqOffBudget && offWorst > irqOffBudget ? "  OVER" : "");
+	printf(", from %s+%X\n", symbolAt(worstPc, &offset), offset);
+	printf("%-34s %8s %8s %8llu %8llu%s\n", "PS/2 bit after clock edge", "", "",
+		(unsigned long long)kbd.bitWorst, (unsigned long long)bitBudget,
+		bitBudget && kbd.bitWorst > bitBudget ? "  OVER" : "");
+	over |= irqOffBudget && offWorst > irqOffBudget;
+	over |= bitBudget && kbd.bitWorst > bitBudget;
+	if (!txBytes) {
+		printf("no TVI output, the keyboard never got through\n");
+		over = true;
+	}
+	if (verbose)
+		printf("%zu symbols, %zu routines\n", symbols.size(), routines.size());
+	return over;
+}
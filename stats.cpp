@@ -0,0 +1,160 @@
+/* stats.cpp, latency histograms and health counters for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The reply is worked out a byte at a time as Serial has room for it, so a
+// query never blocks loop().  TVI frames wait in their queue meanwhile (see
+// stats_sending()) and the terminal gets the reply whole.  The counters
+// owned by other modules are read as the reply goes out, and cleared here
+// too.  The ones the PS/2 interrupts count in are read and cleared with
+// interrupts off, as they're two bytes.
+//
+// Queries are picked out of what the terminal sends by termrx.cpp.
+
+#include "stats.h"
+#include "ps2cmd.h"
+#include "tviq.h"
+#include "ps2rx.h"
+#include "boot.h"
+
+#ifdef STATS
+
+#define PAYLOAD		(2 * (NSTATS + NSTAGES * (1 + STATS_BUCKETS)))
+#define HEADER		5
+
+volatile unsigned int stats_counts[NCOUNTS];
+
+static unsigned int hist[NSTAGES][STATS_BUCKETS];
+static unsigned int longest[NSTAGES];
+
+static byte clear;			// Start over once the reply is out
+static byte sendPos;			// Next byte of the reply, 0 when idle
+static byte sum;
+
+void stats_begin(void) {
+	hal_stampBegin();
+}
+
+void stats_time(byte stage, unsigned int t) {
+	byte b = 0;
+	unsigned int v = t;
+
+	while (v && b < STATS_BUCKETS-1) {
+		v >>= 1;
+		b++;
+	}
+	if (hist[stage][b] != 0xFFFF)
+		hist[stage][b]++;
+	if (t > longest[stage])
+		longest[stage] = t;
+}
+
+static unsigned int atomic(volatile unsigned int &v) {
+	unsigned int n;
+
+	noInterrupts();
+	n = v;
+	interrupts();
+	return n;
+}
+
+// The i'th word of the payload
+static unsigned int word(byte i) {
+	byte stage;
+
+	switch (i) {
+		case STAT_CMDFAIL:	return ps2cmd_failures;
+		case STAT_RESEND:	return ps2cmd_resends;
+		case STAT_TXDROP:	return tviq_drops + tviq_merges;
+		case STAT_TXHIGH:	return tviq_highWater;
+		case STAT_RXFRAME:	return atomic(ps2rx_framing);
+		case STAT_RXOVER:	return atomic(ps2rx_overruns);
+		case STAT_BOOT:		return boot_result;
+		case STAT_BOOTMS:	return boot_ms;
+	}
+	if (i < NCOUNTS)
+		return atomic(stats_counts[i]);
+	i -= NSTATS;
+	stage = i / (1 + STATS_BUCKETS);
+	i %= 1 + STATS_BUCKETS;
+	return i ? hist[stage][i-1] : longest[stage];
+}
+
+static byte replyByte(byte pos) {
+	byte c;
+
+	if (pos < HEADER) {
+		sum = 0;
+		return pos < 3 ? "TVS"[pos] : pos == 3 ? STATS_VERSION : PAYLOAD;
+	}
+	if (pos == HEADER + PAYLOAD)
+		return sum;
+	pos -= HEADER;
+	c = word(pos >> 1) >> (pos & 1 ? 8 : 0);
+	sum += c;
+	return c;
+}
+
+static void reset(void) {
+	byte i, b;
+
+	noInterrupts();
+	for (i=0; i<NCOUNTS; i++)
+		stats_counts[i] = 0;
+	ps2rx_framing = 0;
+	ps2rx_overruns = 0;
+	interrupts();
+	ps2cmd_failures = 0;
+	ps2cmd_resends = 0;
+	tviq_drops = 0;
+	tviq_merges = 0;
+	tviq_highWater = 0;
+	for (i=0; i<NSTAGES; i++) {
+		longest[i] = 0;
+		for (b=0; b<STATS_BUCKETS; b++)
+			hist[i][b] = 0;
+	}
+}
+
+// Answer with the reply, and maybe start over after it
+void stats_query(bool clearAfter) {
+	if (!sendPos) {
+		clear = clearAfter;
+		sendPos = 1;
+	}
+}
+
+// Called from loop(): send what fits of a reply
+void stats_poll(void) {
+	while (sendPos && Serial.availableForWrite() > 0) {
+		Serial.write(replyByte(sendPos - 1));
+		if (++sendPos > HEADER + PAYLOAD + 1) {
+			sendPos = 0;
+			if (clear)
+				reset();
+		}
+	}
+}
+
+bool stats_sending(void) {
+	return sendPos != 0;
+}
+
+static_assert(HEADER + PAYLOAD + 1 < 255, "reply too long to count in a byte");
+
+#endif
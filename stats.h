@@ -0,0 +1,118 @@
+/* stats.h, latency histograms and health counters for PS2_TVI.cpp
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Each keystroke is timed through decode(), the xlat() lookup and
+// tviq_put() with hal_stamp(), and then for as long as its frame waits in
+// the TVI queue before Serial takes it.  Together that is the time from
+// reading the scan code to the frame going to the UART.  Every stage keeps
+// a histogram of powers of two (bucket b counts times below 2^b units, the
+// last one everything longer) and its longest time.
+//
+// When the terminal sends STATS_QUERY (ESC US S) the converter answers with
+// one binary frame, in between TVI frames:
+//
+//	"TVS" STATS_VERSION, payload length, payload, 8 bit sum of the payload
+//
+// The payload is little endian 16 bit words: the NSTATS counters below,
+// then per stage its maximum and STATS_BUCKETS counts.  Stage units are
+// HAL_STAMP_NS, except ST_WAIT which counts in 16us.  Everything saturates
+// at 0xFFFF.  ESC US Z answers the same way and then starts counting over,
+// every counter and stage but STAT_BOOT and STAT_BOOTMS, which are about
+// this power on.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "hal.h"
+
+// Comment out to build without any of this, and ignore the query
+#define STATS
+
+#define STATS_VERSION	4
+#define STATS_BUCKETS	12
+#define STATS_WAIT_SHIFT	4	// ST_WAIT is in micros() >> 4
+
+// Stages
+#define ST_DECODE	0		// decode()
+#define ST_XLAT		1		// Modifiers to TVI status, xlat()
+#define ST_ENQUEUE	2		// tviq_put()
+#define ST_WAIT		3		// In the queue until Serial.write()
+#define NSTAGES		4
+
+// Counters, in the order they're sent.  The first NCOUNTS are kept here,
+// the rest are read from ps2cmd.cpp, tviq.cpp, ps2rx.cpp and boot.cpp.
+#define STAT_PARITY	0		// Keyboard bytes with bad parity
+#define STAT_UNKNOWN	1		// Keys pressed that have no keycode
+#define STAT_TERMRX	2		// Bytes from the terminal we didn't know
+#define NCOUNTS		3
+#define STAT_CMDFAIL	3		// LED and typematic commands given up on
+#define STAT_RESEND	4		// Command bytes sent again
+#define STAT_TXDROP	5		// TVI frames dropped or merged
+#define STAT_TXHIGH	6		// Most TVI frames ever queued
+#define STAT_RXFRAME	7		// Keyboard bytes with bad start or stop bits
+#define STAT_RXOVER	8		// Keyboard bytes dropped with the ring full
+#define STAT_BOOT	9		// How the keyboard's self test went, BOOT_
+#define STAT_BOOTMS	10		// Boot to ready in ms, 0 until then
+#define NSTATS		11
+
+// ESC US, then which
+#define STATS_QUERY	'S'
+#define STATS_CLEAR	'Z'
+
+#ifdef STATS
+extern volatile unsigned int stats_counts[NCOUNTS];	// STAT_PARITY from the PS/2 interrupts
+
+void stats_begin(void);
+void stats_time(byte stage, unsigned int t);
+void stats_query(bool clearAfter);
+void stats_poll(void);
+bool stats_sending(void);
+
+static inline void stats_count(byte stat) {
+	if (stats_counts[stat] != 0xFFFF)
+		stats_counts[stat]++;
+}
+
+static inline uint16_t stats_start(void) {
+	return hal_stamp();
+}
+
+// Time since start in HAL_STAMP_NS units, and where the next stage starts
+static inline uint16_t stats_stage(byte stage, uint16_t start) {
+	uint16_t now = hal_stamp();
+
+	stats_time(stage, (uint16_t)(now - start));
+	return now;
+}
+
+static inline uint16_t stats_waitStamp(void) {
+	return micros() >> STATS_WAIT_SHIFT;
+}
+#else
+static inline void stats_begin(void) {}
+static inline uint16_t stats_start(void) { return 0; }
+static inline void stats_count(byte) {}
+static inline uint16_t stats_stage(byte, uint16_t) { return 0; }
+static inline void stats_time(byte, unsigned int) {}
+static inline void stats_query(bool) {}
+static inline void stats_poll(void) {}
+static inline bool stats_sending(void) { return false; }
+#endif
+
+#endif
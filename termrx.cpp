@@ -0,0 +1,205 @@
+/* termrx.cpp, what the terminal sends back on the keyboard line
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The ring is the Arduino core's: it already has the USART RX interrupt,
+// and a second handler for it wouldn't link.  See termrx.h.
+
+#include "termrx.h"
+#include "converter.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifndef TRACE_CAPTURE
+
+#define BEL		0x07
+#define ESC		0x1B
+#define US		0x1F
+
+// Where in an ESC US command we are
+#define S_IDLE		0
+#define S_ESC		1
+#define S_LETTER	2
+#define S_ARG		3
+
+struct Command {
+	byte letter;
+	byte args;			// Bytes after the letter, 0 or 1
+	void (*fn)(byte letter, byte arg);
+};
+
+static void query(byte letter, byte) {
+	stats_query(letter == STATS_CLEAR);
+}
+
+static void dump(byte, byte) {
+	trace_dump();
+}
+
+// The terminal's idea of the locks wins; converter_poll() sends the LEDs
+static void locks(byte, byte m) {
+	Converter &c = converters[0];
+
+	c.modifier &= ~(MOD_CLOCK|MOD_NLOCK);
+	if (m & TERMRX_ALOCK)
+		c.modifier |= MOD_CLOCK;
+	if (m & TERMRX_NLOCK)
+		c.modifier |= MOD_NLOCK;
+	typematic_check(c.rep, c.keys, c.modifier);
+}
+
+static void sendLog(byte, byte);
+
+static const Command commands[] PROGMEM = {
+	{ STATS_QUERY,	0, query },
+	{ STATS_CLEAR,	0, query },
+	{ TRACE_DUMP,	0, dump },
+	{ TERMRX_LOCKS,	1, locks },
+	{ TERMRX_DUMP,	0, sendLog },
+};
+#define NCOMMANDS	(sizeof(commands) / sizeof(commands[0]))
+
+#define HEADER		5
+
+static byte captured[TERMRX_LOG];
+static byte logHead, logCount;		// Next to fill, and how many kept
+static byte sendFirst, sendCount;
+static byte sendPos;			// Next byte of the reply, 0 when idle
+
+static byte state;
+static byte cmd;			// Its index in commands[] in S_ARG
+static byte letter;
+
+static bool bellOn;
+static unsigned long bellAt;
+
+static void capture(byte c) {
+	stats_count(STAT_TERMRX);
+	trace_put(TR_HOST, c, 0);
+	captured[logHead++ & (TERMRX_LOG-1)] = c;
+	if (logCount < TERMRX_LOG)
+		logCount++;
+}
+
+static void sendLog(byte, byte) {
+	if (sendPos)
+		return;
+	sendFirst = logHead - logCount;
+	sendCount = logCount;
+	logCount = 0;
+	sendPos = 1;
+}
+
+static void run(byte i, byte arg) {
+	void (*fn)(byte, byte) = (void (*)(byte, byte))pgm_read_ptr(&commands[i].fn);
+
+	trace_put(TR_HOST, arg, 1);
+	fn(letter, arg);
+}
+
+// One byte from the terminal
+static void dispatch(byte c) {
+	byte i;
+
+	switch (state) {
+		case S_ESC:
+			if (c == US) {
+				state = S_LETTER;
+				return;
+			}
+			capture(ESC);
+			state = S_IDLE;
+			break;		// and c is a byte of its own
+		case S_LETTER:
+			state = S_IDLE;
+			for (i=0; i<NCOMMANDS; i++)
+				if (pgm_read_byte(&commands[i].letter) == c)
+					break;
+			if (i == NCOMMANDS) {
+				capture(ESC);
+				capture(US);
+				capture(c);
+			} else if (pgm_read_byte(&commands[i].args)) {
+				cmd = i;
+				letter = c;
+				state = S_ARG;
+			} else {
+				letter = c;
+				run(i, c);
+			}
+			return;
+		case S_ARG:
+			state = S_IDLE;
+			run(cmd, c);
+			return;
+	}
+
+	if (c == ESC) {
+		state = S_ESC;
+	} else if (c == BEL) {
+		trace_put(TR_HOST, c, 1);
+		if (!converter_resetting()) {
+			digitalWrite(LED_PIN, HIGH);
+			bellOn = true;
+			bellAt = millis();
+		}
+	} else {
+		capture(c);
+	}
+}
+
+void termrx_begin(void) {
+	pinMode(LED_PIN, OUTPUT);
+}
+
+// Called from loop() after the keyboards: a few bytes from the terminal, and
+// what fits of a capture log reply
+void termrx_poll(void) {
+	byte n;
+	int c;
+
+	for (n=0; n<TERMRX_BUDGET && (c = Serial.read()) >= 0; n++)
+		dispatch(c);
+	if (bellOn && millis() - bellAt >= TERMRX_BELL_MS) {
+		if (!converter_resetting())	// Then it's lit for that instead
+			digitalWrite(LED_PIN, LOW);
+		bellOn = false;
+	}
+	while (sendPos && Serial.availableForWrite() > 0) {
+		c = sendPos - 1;
+		if (c < HEADER)
+			c = c < 3 ? "TVU"[c] : c == 3 ? TERMRX_VERSION : sendCount;
+		else
+			c = captured[(byte)(sendFirst + c - HEADER) & (TERMRX_LOG-1)];
+		Serial.write(c);
+		if (++sendPos > HEADER + sendCount)
+			sendPos = 0;
+	}
+}
+
+bool termrx_sending(void) {
+	return sendPos != 0;
+}
+
+#else
+
+void termrx_begin(void) {}
+void termrx_poll(void) {}
+bool termrx_sending(void) { return false; }
+
+#endif
@@ -0,0 +1,66 @@
+/* termrx.h, what the terminal sends back on the keyboard line
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The UART's receive interrupt puts each byte from the terminal into
+// Serial's RX ring (SERIAL_RX_BUFFER_SIZE, 64 bytes), and wakes loop().
+// termrx_poll() runs after the keyboards have been read and handles at most
+// TERMRX_BUDGET bytes a pass, so however much the terminal sends, a scan
+// code waits behind no more than that.  What's left waits in the ring.
+//
+// Recognised, the rest are dispatched from a table in termrx.cpp:
+//
+//	BEL			LED_PIN on for TERMRX_BELL_MS, unless Sys-Rq has it
+//	ESC US STATS_QUERY	stats.h, and ESC US STATS_CLEAR
+//	ESC US TRACE_DUMP	trace.h
+//	ESC US TERMRX_LOCKS m	the terminal's locks: bit 0 alpha lock, bit 1
+//				num lock.  The keyboard LEDs follow.
+//	ESC US TERMRX_DUMP	the capture log, see below
+//
+// Anything else (a stray ESC, or an ESC US with a letter we don't know, in
+// full) is counted in STAT_TERMRX and kept in a capture log of the last
+// TERMRX_LOG bytes.  ESC US TERMRX_DUMP gets it back, in between TVI frames
+// as the stats reply does:
+//
+//	"TVU" TERMRX_VERSION, count, that many bytes oldest first
+//
+// and starts it over.  With TRACE_RING each byte is a TR_HOST record too.
+// With TRACE_CAPTURE the line only carries the trace and nothing is read.
+
+#ifndef TERMRX_H
+#define TERMRX_H
+
+#include "hal.h"
+
+#define TERMRX_VERSION	1
+#define TERMRX_BUDGET	4		// Bytes handled per pass of loop()
+#define TERMRX_LOG	16		// Unknown bytes kept, a power of two
+#define TERMRX_BELL_MS	100
+
+// ESC US, then which
+#define TERMRX_LOCKS	'L'
+#define TERMRX_DUMP	'U'
+
+#define TERMRX_ALOCK	1
+#define TERMRX_NLOCK	2
+
+void termrx_begin(void);
+void termrx_poll(void);
+bool termrx_sending(void);
+
+#endif
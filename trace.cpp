@@ -0,0 +1,155 @@
+/* trace.cpp, binary trace of scan codes in and TVI frames out
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// With TRACE_CAPTURE, records go into a ring of bytes and out through
+// Serial as it has room, so capturing never blocks loop().  If the ring
+// fills, records are counted and a TR_LOST record says how many went
+// missing once there's room again.
+//
+// With TRACE_RING, trace_put() in trace.h fills the ring and this only
+// sends it when asked, a byte at a time as Serial has room.  The ring is
+// frozen meanwhile and TVI frames wait, see tviq_pump().
+
+#include "trace.h"
+
+#ifdef TRACE_CAPTURE
+
+static byte ring[TRACE_BUFFER];
+static byte rhead, rcount;
+static unsigned long lastUs;		// micros() of the last record, in whole ticks
+static byte lost;
+
+static void putByte(byte c) {
+	ring[(rhead + rcount) % TRACE_BUFFER] = c;
+	rcount++;
+}
+
+static void putRec(byte type, byte a, byte b, unsigned int dt) {
+	putByte(type);
+	putByte(a);
+	putByte(b);
+	putByte(dt & 0xFF);
+	putByte(dt >> 8);
+}
+
+void trace_begin(void) {
+	Serial.begin(TRACE_BAUD, SERIAL_8N1);
+	putByte('T');
+	putByte('V');
+	putByte('T');
+	putByte(TRACE_VERSION);
+	lastUs = micros();
+}
+
+// Room for a record, and a TR_GAP or TR_LOST in front of it
+bool trace_room(void) {
+	return rcount <= TRACE_BUFFER - 3*TRACE_REC;
+}
+
+// A record, and a TR_GAP first if it's been too long for its dt.  Times are
+// kept as micros() differences, so its wrapping every 71 minutes is harmless.
+void trace_put(byte type, byte a, byte b) {
+	unsigned long dt;
+
+	if (type != TR_SCAN && type != TR_TVI)
+		return;
+
+	if (!trace_room()) {
+		if (lost < 255)
+			lost++;
+		return;
+	}
+	dt = (micros() - lastUs) / TRACE_TICK_US;
+	lastUs += dt * TRACE_TICK_US;
+	if (dt > 0xFFFF) {
+		putRec(TR_GAP, dt >> 16, dt >> 24, dt & 0xFFFF);
+		dt = 0;
+	}
+	if (lost) {
+		putRec(TR_LOST, lost, 0, dt);
+		lost = 0;
+		dt = 0;
+	}
+	putRec(type, a, b, dt);
+	trace_pump();
+}
+
+void trace_pump(void) {
+	while (rcount && Serial.availableForWrite() > 0) {
+		Serial.write(ring[rhead]);
+		rhead = (rhead + 1) % TRACE_BUFFER;
+		rcount--;
+	}
+}
+
+#elif defined(TRACE_RING)
+
+#define HEADER		5
+
+TraceRec trace_ring[TRACE_RING_SIZE];
+byte trace_head;
+bool trace_frozen;
+
+static byte first;			// Oldest record being sent
+static byte count;
+static unsigned int sendPos;		// Next byte of the dump, 0 when idle
+
+void trace_dump(void) {
+	byte i;
+
+	if (trace_frozen)
+		return;
+	trace_frozen = true;
+	// Records never filled in are still TR_GAP, and not worth sending
+	for (count = TRACE_RING_SIZE, i = 0; i < TRACE_RING_SIZE; i++)
+		if (trace_ring[i].type == TR_GAP)
+			count--;
+	first = trace_head - count;
+	sendPos = 1;
+}
+
+static byte dumpByte(unsigned int pos) {
+	if (pos < HEADER)
+		return pos < 3 ? "TVR"[pos] : pos == 3 ? TRACE_VERSION : count;
+	pos -= HEADER;
+	TraceRec &r = trace_ring[(byte)(first + pos / TRACE_REC) & (TRACE_RING_SIZE-1)];
+	switch (pos % TRACE_REC) {
+		case 0:		return r.type;
+		case 1:		return r.a;
+		case 2:		return r.b;
+		case 3:		return r.stamp & 0xFF;
+		default:	return r.stamp >> 8;
+	}
+}
+
+void trace_pump(void) {
+	while (sendPos && Serial.availableForWrite() > 0) {
+		Serial.write(dumpByte(sendPos - 1));
+		if (++sendPos > HEADER + (unsigned int)count * TRACE_REC) {
+			sendPos = 0;
+			trace_frozen = false;
+		}
+	}
+}
+
+bool trace_sending(void) {
+	return trace_frozen;
+}
+
+#endif
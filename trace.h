@@ -0,0 +1,117 @@
+/* trace.h, binary trace of scan codes in and TVI frames out
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// A trace is the four bytes "TVT" TRACE_VERSION followed by 5 byte records:
+//
+//	type, a, b, dt (16 bits, low byte first)
+//
+// dt is the time since the previous record in TRACE_TICK_US units.  A longer
+// gap goes in a TR_GAP record of its own, whose a and b are bits 16 - 31 of
+// its dt, so one record covers up to 4.7 hours.  Traces come from the
+// firmware built with TRACE_CAPTURE, which sends them over the serial line
+// instead of TVI frames, or from host/tvi_replay -u.  Only TR_SCAN and
+// TR_TVI records are captured, which is all a replay needs.
+//
+// Built with TRACE_RING instead, the converter works as usual and keeps the
+// last TRACE_RING_SIZE records of every kind in RAM.  ESC US T from the
+// terminal gets them back as "TVR" TRACE_VERSION, a count, and that many
+// records, oldest first, in the same layout except that the last field is
+// hal_stamp() when the record was made (so times wrap every 32.8ms).
+// host/tvi_tracedump prints either kind of trace as text.  trace_put() is
+// inline and a handful of instructions; without either define it's nothing.
+// It's only for loop(), not interrupt handlers.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "hal.h"
+
+#define TRACE_VERSION	2
+#define TRACE_TICK_US	4		// micros() resolution at 16MHz
+#define TRACE_REC	5
+
+#define TR_GAP		0		// Just time passing, a and b extend dt
+#define TR_SCAN		1		// a = byte read from the keyboard
+#define TR_TVI		2		// a = status, b = code handed to the UART
+#define TR_LOST		3		// a = records dropped before this one
+#define TR_KEY		4		// a = what decode() made of it, b = key
+#define TR_XLAT		5		// a = status, b = code translated
+#define TR_CMD		6		// a = byte sent to the keyboard, b = its answer
+#define TR_HOST		7		// a = byte from the terminal, b = 1 if acted on
+
+// Define TRACE_CAPTURE to have the converter send a trace instead of talking
+// to the terminal, at TRACE_BAUD
+// #define TRACE_CAPTURE
+#define TRACE_BAUD	115200
+#define TRACE_BUFFER	128		// Bytes waiting for the UART
+
+// Or TRACE_RING to keep the latest records for ESC US TRACE_DUMP
+// #define TRACE_RING
+#define TRACE_RING_SIZE	32		// Records, a power of two
+#define TRACE_DUMP	'T'
+
+#if defined(TRACE_CAPTURE) && defined(TRACE_RING)
+#error "TRACE_CAPTURE and TRACE_RING both need the serial line"
+#endif
+
+#ifdef TRACE_CAPTURE
+void trace_begin(void);
+void trace_put(byte type, byte a, byte b);
+bool trace_room(void);
+void trace_pump(void);
+static inline void trace_dump(void) {}
+static inline bool trace_sending(void) { return false; }
+#elif defined(TRACE_RING)
+struct TraceRec {
+	byte type;
+	byte a;
+	byte b;
+	uint16_t stamp;
+};
+
+extern TraceRec trace_ring[TRACE_RING_SIZE];
+extern byte trace_head;			// Next record to fill, counting up
+extern bool trace_frozen;		// Being sent, leave it alone
+
+void trace_dump(void);
+void trace_pump(void);
+bool trace_sending(void);
+
+static inline void trace_begin(void) {
+	hal_stampBegin();
+}
+
+static inline void trace_put(byte type, byte a, byte b) {
+	if (trace_frozen)
+		return;
+	TraceRec &r = trace_ring[trace_head++ & (TRACE_RING_SIZE-1)];
+	r.type = type;
+	r.a = a;
+	r.b = b;
+	r.stamp = hal_stamp();
+}
+#else
+static inline void trace_begin(void) {}
+static inline void trace_put(byte, byte, byte) {}
+static inline void trace_pump(void) {}
+static inline void trace_dump(void) {}
+static inline bool trace_sending(void) { return false; }
+#endif
+
+#endif
@@ -0,0 +1,290 @@
+/* tvi_legacy.h, the original scan code and translation tables
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// These are the tables loop() used to run every keystroke through:
+// ps2_to_intermediate, then shift, alpha lock, the control mask, the reverse
+// shift check, and finally intermediate_to_tvi.  Nothing uses them at run
+// time any more; they are kept verbatim as the reference decode.cpp and
+// tvi_xlat.cpp build their own tables from at compile time, and for the
+// host tools, see host/tvi_fuzz.cpp.
+
+#ifndef TVI_LEGACY_H
+#define TVI_LEGACY_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+
+//https://wiki.osdev.org/PS/2_Keyboard#Scan_Code_Sets.2C_Scan_Codes_and_Key_Codes
+constexpr byte ps2_to_intermediate[] = {
+
+	0, // 00h = err
+	KEY_F9, // 01h = F9
+	0, // 02h = 
+	KEY_F5, // 03h = F5
+	KEY_F3, // 04h = F3
+	KEY_F1, // 05h = F1
+	KEY_F2, // 06h = F2
+	KEY_F12, // 07h = F12
+	0, // 08h = 
+	KEY_F10, // 09h = F10
+	KEY_F8, // 0Ah = F8
+	KEY_F6, // 0Bh = F6
+	KEY_F4, // 0Ch = F4
+	KEY_TAB, // 0Dh = TAB
+	'`', // 0Eh = ` (back quote)
+	0, // 0Fh = 
+	0, // 10h = 
+	0, // 11h = LALT
+	0, // 12h = LSHIFT
+	0, // 13h = 
+	0, // 14h = LCTRL
+	'q', // 15h = Q
+	'1', // 16h = 1
+	0, // 17h = 
+	0, // 18h = 
+	0, // 19h = 
+	'z', // 1Ah = Z
+	's', // 1Bh = S
+	'a', // 1Ch = A
+	'w', // 1Dh = W
+	'2', // 1Eh = 2
+	0, // 1Fh = 
+	0, // 20h = 
+	'c', // 21h = C
+	'x', // 22h = X
+	'd', // 23h = D
+	'e', // 24h = E
+	'4', // 25h = 4
+	'3', // 26h = 3
+	0, // 27h = 
+	0, // 28h = 
+	' ', // 29h = SPACE
+	'v', // 2Ah = V
+	'f', // 2Bh = F
+	't', // 2Ch = T
+	'r', // 2Dh = R
+	'5', // 2Eh = 5
+	0, // 2Fh = 
+	0, // 30h = 
+	'n', // 31h = N
+	'b', // 32h = B
+	'h', // 33h = H
+	'g', // 34h = G
+	'y', // 35h = Y
+	'6', // 36h = 6
+	0, // 37h = 
+	0, // 38h = 
+	0, // 39h = 
+	'm', // 3Ah = M
+	'j', // 3Bh = J
+	'u', // 3Ch = U
+	'7', // 3Dh = 7
+	'8', // 3Eh = 8
+	0, // 3Fh = 
+	0, // 40h = 
+	',', // 41h = , comma
+	'k', // 42h = K
+	'i', // 43h = I
+	'o', // 44h = O
+	'0', // 45h = 0 (zero)
+	'9', // 46h = 9
+	0, // 47h = 
+	0, // 48h = 
+	'.', // 49h = . dot
+	'/', // 4Ah = /
+	'l', // 4Bh = L
+	';', // 4Ch = ;
+	'p', // 4Dh = P
+	'-', // 4Eh = -
+	0, // 4Fh = 
+	0, // 50h = 
+	0, // 51h = 
+	0x27, // 52h = ' (quote)
+	0, // 53h = 
+	'[', // 54h = [
+	'=', // 55h = =
+	0, // 56h = 
+	0, // 57h = 
+	0, // 58h = CAPS LOCK
+	0, // 59h = RSHIFT
+	KEY_ENTER, // 5Ah = ENTER
+	']', // 5Bh = ]
+	0, // 5Ch = 
+	0x5C, // 5Dh = BKSLASH
+	0, // 5Eh = 
+	0, // 5Fh = 
+	0, // 60h = 
+	0, // 61h = 
+	0, // 62h = 
+	0, // 63h = 
+	0, // 64h = 
+	0, // 65h = 
+	KEY_BKSP, // 66h = BKSP
+	0, // 67h = 
+	0, // 68h = 
+	KEY_KP_1, // 69h = KP1
+	0, // 6Ah = 
+	KEY_KP_4, // 6Bh = KP4
+	KEY_KP_7, // 6Ch = KP7
+	0, // 6Dh = 
+	0, // 6Eh = 
+	0, // 6Fh = 
+	KEY_KP_0, // 70h = KP 0
+	KEY_KP_DOT, // 71h = KP .
+	KEY_KP_2, // 72h = KP 2
+	KEY_KP_5, // 73h = KP 5
+	KEY_KP_6, // 74h = KP 6
+	KEY_KP_8, // 75h = KP 8
+	KEY_ESC, // 76h = ESC
+	0, // 77h = NUM LOCK
+	KEY_F11, // 78h = F11
+	KEY_KP_PLUS, // 79h = KP +
+	KEY_KP_3, // 7Ah = KP 3
+	KEY_KP_DASH, // 7Bh = KP -
+	KEY_KP_STAR, // 7Ch = KP *
+	KEY_KP_9, // 7Dh = KP 9
+	KEY_SLOCK, // 7Eh = SCROLL LOCK
+	0, // 7Fh
+	0, // 80h
+	0, // 81h
+	0, // 82h
+	KEY_F7, // 83h = F7
+
+};
+#define NUM_PS2SCAN (sizeof(ps2_to_intermediate)/sizeof(ps2_to_intermediate[0]))
+
+constexpr byte intermediate_shift_xlat[256] = {
+
+0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 
+0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 
+' ' , '!' , '"' , '#' , '$' , '%' , '&' , '"' , '(' , ')' , '*' , '+' , '<' , '_' , '>' , '?' , 
+')' , '!' , '@' , '#' , '$' , '%' , '^' , '&' , '*' , '(' , ':' , ':' , '<' , '+' , '>' , '?' , 
+'@' , 'A' , 'B' , 'C' , 'D' , 'E' , 'F' , 'G' , 'H' , 'I' , 'J' , 'K' , 'L' , 'M' , 'N' , 'O' , 
+'P' , 'Q' , 'R' , 'S' , 'T' , 'U' , 'V' , 'W' , 'X' , 'Y' , 'Z' , '{' , '|' , '}' , '^' , '_' , 
+'~' , 'A' , 'B' , 'C' , 'D' , 'E' , 'F' , 'G' , 'H' , 'I' , 'J' , 'K' , 'L' , 'M' , 'N' , 'O' , 
+'P' , 'Q' , 'R' , 'S' , 'T' , 'U' , 'V' , 'E' , 'X' , 'Y' , 'Z' , '{' , '|' , '}' , '~' , 0x7F, 
+0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF, 
+0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 
+0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF, 
+0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF, 
+0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F, 
+0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F, 
+0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 
+0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 
+
+};
+constexpr byte intermediate_alock_xlat[256] = {
+
+0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 
+0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 
+' ' , '!' , '"' , '#' , '$' , '%' , '&' , 0x27, '(' , ')' , '*' , '+' , ',' , '-' , '.' , '/' , 
+'0' , '1' , '2' , '3' , '4' , '5' , '6' , '7' , '8' , '9' , ':' , ';' , '<' , '=' , '>' , '?' , 
+'@' , 'A' , 'B' , 'C' , 'D' , 'E' , 'F' , 'G' , 'H' , 'I' , 'J' , 'K' , 'L' , 'M' , 'N' , 'O' , 
+'P' , 'Q' , 'R' , 'S' , 'T' , 'U' , 'V' , 'W' , 'X' , 'Y' , 'Z' , '[' , '\\', ']' , '^' , '_' , 
+'`' , 'A' , 'B' , 'C' , 'D' , 'E' , 'F' , 'G' , 'H' , 'I' , 'J' , 'K' , 'L' , 'M' , 'N' , 'O' , 
+'P' , 'Q' , 'R' , 'S' , 'T' , 'U' , 'V' , 'E' , 'X' , 'Y' , 'Z' , '{' , '|' , '}' , '~' , 0x7F, 
+0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F, 
+0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F, 
+0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 
+0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 
+0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF, 
+0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 
+0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF, 
+0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF, 
+
+};
+
+constexpr byte intermediate_to_tvi[256] = {
+
+// ^x in 00-1F
+0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 
+0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 
+// Normal characters 20-7E. leave 7F in case we use it later.
+' ' , '!' , '"' , '#' , '$' , '%' , '&' , 0x27, '(' , ')' , '*' , '+' , ',' , '-' , '.' , '/' , 
+'0' , '1' , '2' , '3' , '4' , '5' , '6' , '7' , '8' , '9' , ':' , ';' , '<' , '=' , '>' , '?' , 
+'@' , 'A' , 'B' , 'C' , 'D' , 'E' , 'F' , 'G' , 'H' , 'I' , 'J' , 'K' , 'L' , 'M' , 'N' , 'O' , 
+'P' , 'Q' , 'R' , 'S' , 'T' , 'U' , 'V' , 'W' , 'X' , 'Y' , 'Z' , '[' , '\\', ']' , '^' , '_' , 
+'`' , 'a' , 'b' , 'c' , 'd' , 'e' , 'f' , 'g' , 'h' , 'i' , 'j' , 'k' , 'l' , 'm' , 'n' , 'o' , 
+'p' , 'q' , 'r' , 's' , 't' , 'u' , 'v' , 'w' , 'x' , 'y' , 'z' , '{' , '|' , '}' , '~' , 0x7F,
+// 80-8F = unshifted F1-F16
+0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 
+// 90-9F = KP digits 0-9 . + - * / ENTER
+//                                                            .    ,     -    ce   send   enter
+0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xAE, 0xAC, 0xAD, 0xF8, 0xF2, 0xF4, 
+// A0-AF = special keys
+// SLOC BRK PRTS SYSRQ                          ENTR  BKSP  TAB   ESC
+// NSCR BRK PRNT                                RETN  BKSP  TAB   ESC
+0xFD, 0xFB, 0x92, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8D, 0x8F, 0x89, 0xF0, 0x00, 0x00, 0x00, 0x00, 
+// B0-BF = edit keys
+// INS END  DOWN  PGDN  LEFT        RIGHT HOME  UP    PGUP  DEL
+// CINS SEND DOWN PAGE  LEFT        RIGHT HOME  UP          DEL
+0x94, 0xF2, 0x8A, 0x9A, 0x88, 0x00, 0x8C, 0x8E, 0x8B, 0x9A, 0x7F, 0x00, 0x00, 0x00, 0x00, 0x00, 
+// C0-CF = shifted F1-F16
+0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF, 
+// D0-DF = shifted KP digits 0-9 . + - * / ENTER
+//                                                            .    ,     -    ce   send   enter
+0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xAE, 0xAC, 0xAD, 0xF9, 0xF3, 0xF5,
+// E0-EF = shifted special keys
+// SLOC BRL PRTS SYSRQ                          ENTR  BKSP  TAB   ESC
+// SETU SBRK PRNT                               LF    CLRSP BTAB  LESC
+0xFE, 0xFC, 0xA2, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90, 0x9e, 0x91, 0xF1, 0x00, 0x00, 0x00, 0x00, 
+// F0-FF = shifted edit keys
+// INS END  DOWN  PGDN  LEFT        RIGHT HOME  UP    PGUP  DEL
+// LINS SSEND SDOWN SPAGE SLEFT     SRGHT SHOME SUP   SPAGE LDEL
+0x96, 0xF3, 0x82, 0xAA, 0x80, 0x00, 0x84, 0x86, 0x83, 0xAA, 0x97, 0x00, 0x00, 0x00, 0x00, 0x00, 
+
+};
+
+// These characters should have the shift status the opposite of what they are on a 
+// PS/2 keyboard, due to the TVI keyboard layout -- these are intermediate codes
+// {, ], Line Feed (0xE8), Back Tab (0xE9), Line Insert (0xF0), and Line Delete (0xFA)
+constexpr byte tviReverseShifted[] = {
+	'{',']', 0xE8, 0xE9, 0xEA, 0xF0, 0xFA, 0 };
+
+constexpr byte legacyReverseShift(byte c, byte i = 0) {
+	return !tviReverseShifted[i] ? 0
+		: tviReverseShifted[i] == c ? TVI_SHIFT
+		: legacyReverseShift(c, i + 1);
+}
+
+// The TVI status and code bytes for an intermediate keycode, with the lock
+// and modifier bits in status (TVI_SHIFT, TVI_ALOCK, TVI_CTRL) applied the
+// way loop() used to.  Returns status << 8 | code.
+constexpr byte legacyShifted(byte status, byte c) {
+	return (status & TVI_SHIFT) ? intermediate_shift_xlat[c] : c;
+}
+
+constexpr byte legacyLocked(byte status, byte c) {
+	return (status & TVI_ALOCK) ? intermediate_alock_xlat[legacyShifted(status, c)]
+		: legacyShifted(status, c);
+}
+
+constexpr byte legacyCtrl(byte status, byte c) {
+	return ((status & TVI_CTRL) && c >= 0x40 && c <= 0x7F) ? (c & 0x1F) : c;
+}
+
+constexpr uint16_t legacyXlat3(byte status, byte c) {
+	return (uint16_t)((status ^ legacyReverseShift(c)) << 8) | intermediate_to_tvi[c];
+}
+
+constexpr uint16_t legacyXlat(byte status, byte keycode) {
+	return legacyXlat3(status, legacyCtrl(status, legacyLocked(status, keycode)));
+}
+
+#endif
@@ -0,0 +1,274 @@
+/* tvi_xlat.cpp, generates the fused keycode to TVI table
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The translation is described once, below, as a few rules per step: which
+// character shift and alpha lock turn each keycode into, which TVI code each
+// of those goes out as, and which of them have their shift bit flipped.
+// The compiler runs every keycode under every modifier state through those
+// steps and writes the results into xlat_table, and the static_asserts at
+// the bottom check each step and every table entry against the original
+// three-table pipeline kept in tvi_legacy.h.  With XLAT_COMPACT the table
+// isn't built and xlat() goes through the same steps at run time instead,
+// reading the rules out of flash.
+
+#include "tvi_xlat.h"
+#include "tvi_legacy.h"
+
+// One rule of a byte to byte map.  Codes first through last become
+// code + value, or value itself with XR_FILL.  The first rule that matches
+// wins; codes no rule covers map to themselves.
+struct XlatRule {
+	byte first;
+	byte last;
+	byte value;
+	byte flags;
+};
+#define XR_OFFSET	0
+#define XR_FILL		1
+
+#define XR_ONE(c, v)		{ (c), (c), (v), XR_FILL }
+#define XR_SPAN(f, l, d)	{ (f), (l), (byte)(d), XR_OFFSET }
+#define XR_ALL(f, l, v)		{ (f), (l), (v), XR_FILL }
+
+// Shift: the US layout's shifted characters, and the shifted function,
+// keypad, special and edit keys live 0x40 above the unshifted ones
+static constexpr XlatRule shift_rules[] PROGMEM = {
+	XR_ONE(0x27, '"'), XR_ONE(',', '<'), XR_ONE('-', '_'), XR_ONE('.', '>'),
+	XR_ONE('/', '?'), XR_ONE('0', ')'), XR_ONE('1', '!'), XR_ONE('2', '@'),
+	XR_ONE('3', '#'), XR_ONE('4', '$'), XR_ONE('5', '%'), XR_ONE('6', '^'),
+	XR_ONE('7', '&'), XR_ONE('8', '*'), XR_ONE('9', '('), XR_ONE(';', ':'),
+	XR_ONE('=', '+'), XR_ONE('[', '{'), XR_ONE('\\', '|'), XR_ONE(']', '}'),
+	XR_ONE('`', '~'),
+	XR_ONE('w', 'E'),		// As in the original tables
+	XR_SPAN('a', 'z', 'A' - 'a'),
+	XR_SPAN(0x80, 0xBF, 0x40),
+	XR_SPAN(0xC0, 0xFF, -0x40),
+};
+
+// Alpha lock only touches the letters
+static constexpr XlatRule alock_rules[] PROGMEM = {
+	XR_ONE('w', 'E'),		// As in the original tables
+	XR_SPAN('a', 'z', 'A' - 'a'),
+};
+
+// TVI codes; ASCII goes out as itself
+static constexpr XlatRule tvi_rules[] PROGMEM = {
+	// 80-8F = unshifted F1-F16
+	XR_SPAN(0x80, 0x8F, 0xD0 - 0x80),
+	// 90-9F = KP digits 0-9 . + - * / ENTER
+	XR_SPAN(0x90, 0x99, 0xB0 - 0x90),
+	XR_ONE(0x9A, 0xAE), XR_ONE(0x9B, 0xAC), XR_ONE(0x9C, 0xAD),
+	XR_ONE(0x9D, 0xF8), XR_ONE(0x9E, 0xF2), XR_ONE(0x9F, 0xF4),
+	// A0-AF = special keys: SLOC BRK PRTS, ENTR BKSP TAB ESC
+	XR_ONE(0xA0, 0xFD), XR_ONE(0xA1, 0xFB), XR_ONE(0xA2, 0x92),
+	XR_ONE(0xA8, 0x8D), XR_ONE(0xA9, 0x8F), XR_ONE(0xAA, 0x89), XR_ONE(0xAB, 0xF0),
+	// B0-BF = edit keys: INS END DOWN PGDN LEFT, RIGHT HOME UP PGUP DEL
+	XR_ONE(0xB0, 0x94), XR_ONE(0xB1, 0xF2), XR_ONE(0xB2, 0x8A), XR_ONE(0xB3, 0x9A),
+	XR_ONE(0xB4, 0x88), XR_ONE(0xB6, 0x8C), XR_ONE(0xB7, 0x8E), XR_ONE(0xB8, 0x8B),
+	XR_ONE(0xB9, 0x9A), XR_ONE(0xBA, 0x7F),
+	XR_ALL(0xA0, 0xBF, 0x00),
+	// C0-CF = shifted F1-F16
+	XR_SPAN(0xC0, 0xCF, 0xE0 - 0xC0),
+	// D0-DF = shifted KP digits 0-9 . + - * / ENTER
+	XR_SPAN(0xD0, 0xD9, 0xB0 - 0xD0),
+	XR_ONE(0xDA, 0xAE), XR_ONE(0xDB, 0xAC), XR_ONE(0xDC, 0xAD),
+	XR_ONE(0xDD, 0xF9), XR_ONE(0xDE, 0xF3), XR_ONE(0xDF, 0xF5),
+	// E0-EF = shifted special keys: SETU SBRK PRNT, LF CLRSP BTAB LESC
+	XR_ONE(0xE0, 0xFE), XR_ONE(0xE1, 0xFC), XR_ONE(0xE2, 0xA2),
+	XR_ONE(0xE8, 0x90), XR_ONE(0xE9, 0x9E), XR_ONE(0xEA, 0x91), XR_ONE(0xEB, 0xF1),
+	// F0-FF = shifted edit keys: LINS SSEND SDOWN SPAGE SLEFT, SRGHT SHOME SUP SPAGE LDEL
+	XR_ONE(0xF0, 0x96), XR_ONE(0xF1, 0xF3), XR_ONE(0xF2, 0x82), XR_ONE(0xF3, 0xAA),
+	XR_ONE(0xF4, 0x80), XR_ONE(0xF6, 0x84), XR_ONE(0xF7, 0x86), XR_ONE(0xF8, 0x83),
+	XR_ONE(0xF9, 0xAA), XR_ONE(0xFA, 0x97),
+	XR_ALL(0xE0, 0xFF, 0x00),
+};
+
+// These have the shift status the opposite of what they are on a PS/2
+// keyboard, due to the TVI keyboard layout: {, ], Line Feed, Back Tab,
+// shifted TAB, Line Insert and Line Delete
+static constexpr byte reversed_keys[] PROGMEM = { '{', ']', 0xE8, 0xE9, 0xEA, 0xF0, 0xFA };
+
+#define NRULES(r)	(sizeof(r) / sizeof(r[0]))
+
+static constexpr byte xlatApply(const XlatRule *r, unsigned n, byte c) {
+	return !n ? c
+		: (c >= r->first && c <= r->last)
+			? ((r->flags & XR_FILL) ? r->value : (byte)(c + r->value))
+		: xlatApply(r + 1, n - 1, c);
+}
+
+static constexpr bool xlatReversed(byte c, unsigned i = 0) {
+	return i < sizeof(reversed_keys) && (reversed_keys[i] == c || xlatReversed(c, i + 1));
+}
+
+static constexpr byte xlatShifted(byte status, byte c) {
+	return (status & TVI_SHIFT) ? xlatApply(shift_rules, NRULES(shift_rules), c) : c;
+}
+
+static constexpr byte xlatLocked(byte status, byte c) {
+	return (status & TVI_ALOCK) ? xlatApply(alock_rules, NRULES(alock_rules), c) : c;
+}
+
+// Control turns 40-7F into control codes, after shift and lock
+static constexpr byte xlatCtrl(byte status, byte c) {
+	return ((status & TVI_CTRL) && c >= 0x40 && c <= 0x7F) ? (c & 0x1F) : c;
+}
+
+static constexpr uint16_t xlatOut(byte status, byte c) {
+	return (uint16_t)((status ^ (xlatReversed(c) ? TVI_SHIFT : 0)) << 8)
+		| xlatApply(tvi_rules, NRULES(tvi_rules), c);
+}
+
+static constexpr uint16_t xlatEntry(unsigned i) {
+	return xlatOut((i / XLAT_KEYS) << 4,
+		xlatCtrl((i / XLAT_KEYS) << 4,
+		xlatLocked((i / XLAT_KEYS) << 4,
+		xlatShifted((i / XLAT_KEYS) << 4, i % XLAT_KEYS))));
+}
+
+#ifdef XLAT_COMPACT
+
+// xlatApply(), one rule at a time out of flash
+static byte xlatRun(const XlatRule *r, byte n, byte c) {
+	for (; n; r++, n--) {
+		if (c >= pgm_read_byte(&r->first) && c <= pgm_read_byte(&r->last)) {
+			if (pgm_read_byte(&r->flags) & XR_FILL)
+				return pgm_read_byte(&r->value);
+			return c + pgm_read_byte(&r->value);
+		}
+	}
+	return c;
+}
+
+uint16_t xlat(byte status, byte c) {
+	byte i;
+
+	if (status & TVI_SHIFT)
+		c = xlatRun(shift_rules, NRULES(shift_rules), c);
+	if (status & TVI_ALOCK)
+		c = xlatRun(alock_rules, NRULES(alock_rules), c);
+	if ((status & TVI_CTRL) && c >= 0x40 && c <= 0x7F)
+		c &= 0x1F;
+	for (i=0; i<sizeof(reversed_keys); i++)
+		if (pgm_read_byte(&reversed_keys[i]) == c)
+			status ^= TVI_SHIFT;
+	return (status << 8) | xlatRun(tvi_rules, NRULES(tvi_rules), c);
+}
+
+#else
+
+#define XLAT_E1(i)	xlatEntry(i)
+#define XLAT_E4(i)	XLAT_E1(i), XLAT_E1((i)+1), XLAT_E1((i)+2), XLAT_E1((i)+3)
+#define XLAT_E16(i)	XLAT_E4(i), XLAT_E4((i)+4), XLAT_E4((i)+8), XLAT_E4((i)+12)
+#define XLAT_E64(i)	XLAT_E16(i), XLAT_E16((i)+16), XLAT_E16((i)+32), XLAT_E16((i)+48)
+#define XLAT_E192(i)	XLAT_E64(i), XLAT_E64((i)+64), XLAT_E64((i)+128)
+
+constexpr uint16_t xlat_table[XLAT_STATES * XLAT_KEYS] PROGMEM = {
+	XLAT_E192(0*XLAT_KEYS), XLAT_E192(1*XLAT_KEYS),
+	XLAT_E192(2*XLAT_KEYS), XLAT_E192(3*XLAT_KEYS),
+	XLAT_E192(4*XLAT_KEYS), XLAT_E192(5*XLAT_KEYS),
+	XLAT_E192(6*XLAT_KEYS), XLAT_E192(7*XLAT_KEYS),
+};
+
+#endif
+
+// ---- ASCII back to frames ----
+
+#define XLAT_NONE	0xFFFF
+
+// Keycodes a key sends itself: space, and the characters shift changes.  So
+// 'A' comes from shift and 'a', not from 'A'.
+static constexpr bool xlatTyped(byte k) {
+	return k == ' ' || (k < 0x80 && xlatShifted(TVI_SHIFT, k) != k);
+}
+
+static constexpr uint16_t xlatFirst(uint16_t a, uint16_t b) {
+	return a != XLAT_NONE ? a : b;
+}
+
+// The printable keycode between lo and hi that status turns into c.  The
+// TVI code for a printable character is itself, so only the status needs
+// the whole of xlatEntry().
+static constexpr uint16_t xlatFind(byte status, byte c, unsigned lo, unsigned hi) {
+	return hi - lo == 1
+		? (xlatTyped(lo) && xlatCtrl(status, xlatShifted(status, lo)) == c
+			? xlatEntry(status / 16 * XLAT_KEYS + lo) : XLAT_NONE)
+		: xlatFirst(xlatFind(status, c, lo, (lo + hi) / 2),
+			xlatFind(status, c, (lo + hi) / 2, hi));
+}
+
+// Control characters from control and a letter, or failing that, from
+// control and shift.  Shift and w give E on a TVI keyboard, so W has no
+// key; it goes out as the code with shift.
+static constexpr uint16_t xlatAsciiCtrl(byte c) {
+	return xlatTyped(c | 0x40) ? xlatEntry(TVI_CTRL / 16 * XLAT_KEYS + (c | 0x40))
+		: xlatTyped(c | 0x60) ? xlatEntry(TVI_CTRL / 16 * XLAT_KEYS + (c | 0x60))
+		: xlatFirst(xlatFind(TVI_CTRL|TVI_SHIFT, c, 0x20, 0x80), TVI_SHIFT << 8 | c);
+}
+
+static constexpr uint16_t xlatAscii(byte c) {
+	return c == '\r' || c == '\n' ? xlatEntry(KEY_ENTER)
+		: c == '\t' ? xlatEntry(KEY_TAB)
+		: c == '\b' ? xlatEntry(KEY_BKSP)
+		: c == 0x1B ? xlatEntry(KEY_ESC)
+		: c == 0x7F ? xlatEntry(KEY_E0_DEL)
+		: xlatTyped(c) ? xlatEntry(c)
+		: c < 0x20 ? xlatAsciiCtrl(c)
+		: xlatFirst(xlatFind(TVI_SHIFT, c, 0x20, 0x80), TVI_SHIFT << 8 | c);
+}
+
+#define XLAT_A1(c)	xlatAscii(c)
+#define XLAT_A4(c)	XLAT_A1(c), XLAT_A1((c)+1), XLAT_A1((c)+2), XLAT_A1((c)+3)
+#define XLAT_A16(c)	XLAT_A4(c), XLAT_A4((c)+4), XLAT_A4((c)+8), XLAT_A4((c)+12)
+#define XLAT_A64(c)	XLAT_A16(c), XLAT_A16((c)+16), XLAT_A16((c)+32), XLAT_A16((c)+48)
+
+constexpr uint16_t xlat_ascii[128] PROGMEM = { XLAT_A64(0), XLAT_A64(64) };
+
+// ---- Compile time proof against the original tables ----
+
+// Each rule set reproduces its original table over all 256 codes ...
+static constexpr bool xlatSameMap(const XlatRule *r, unsigned n, const byte *table,
+		unsigned lo, unsigned hi) {
+	return hi - lo == 1 ? xlatApply(r, n, lo) == table[lo]
+		: xlatSameMap(r, n, table, lo, (lo + hi) / 2)
+			&& xlatSameMap(r, n, table, (lo + hi) / 2, hi);
+}
+
+static constexpr bool xlatSameReversed(unsigned lo, unsigned hi) {
+	return hi - lo == 1 ? (xlatReversed(lo) ? TVI_SHIFT : 0) == legacyReverseShift(lo)
+		: xlatSameReversed(lo, (lo + hi) / 2) && xlatSameReversed((lo + hi) / 2, hi);
+}
+
+// ... and every entry of xlat_table is what the three-table pipeline gave
+static constexpr bool xlatSameTable(unsigned lo, unsigned hi) {
+	return hi - lo == 1 ? xlatEntry(lo) == legacyXlat((lo / XLAT_KEYS) << 4, lo % XLAT_KEYS)
+		: xlatSameTable(lo, (lo + hi) / 2) && xlatSameTable((lo + hi) / 2, hi);
+}
+
+static_assert(xlatSameMap(shift_rules, NRULES(shift_rules), intermediate_shift_xlat, 0, 256),
+	"shift_rules differ from intermediate_shift_xlat");
+static_assert(xlatSameMap(alock_rules, NRULES(alock_rules), intermediate_alock_xlat, 0, 256),
+	"alock_rules differ from intermediate_alock_xlat");
+static_assert(xlatSameMap(tvi_rules, NRULES(tvi_rules), intermediate_to_tvi, 0, 256),
+	"tvi_rules differ from intermediate_to_tvi");
+static_assert(xlatSameReversed(0, 256), "reversed_keys differ from tviReverseShifted");
+static_assert(xlatSameTable(0, XLAT_STATES * XLAT_KEYS),
+	"xlat_table differs from the three-table pipeline");
+static_assert(KEY_E0_DEL < XLAT_KEYS && KEY_KP_DOT + NLOCK_OFFSET < XLAT_KEYS,
+	"intermediate keycodes must fit in xlat_table");
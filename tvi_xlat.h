@@ -0,0 +1,76 @@
+/* tvi_xlat.h, keycode to TVI translation in a single table lookup
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TVI_XLAT_H
+#define TVI_XLAT_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+
+// Define XLAT_COMPACT to keep only the translation rules in flash, about
+// 350 bytes, and apply them for each key instead of looking the answer up
+// in the 3K xlat_table.  Slower, but it fits parts with 8K of flash.
+// #define XLAT_COMPACT
+
+// xlat_table holds the final TVI status and code bytes (status << 8 | code)
+// for every intermediate keycode under every combination of shift, alpha
+// lock and control.  ALT only ever adds TVI_FUNCT, so it isn't part of the
+// index.  Built at compile time in tvi_xlat.cpp.
+#define XLAT_KEYS	0xC0			// Intermediate keycodes are all below this
+#define XLAT_STATES	8			// TVI_ALOCK, TVI_SHIFT, TVI_CTRL >> 4
+#define XLAT_MODS	(TVI_ALOCK|TVI_SHIFT|TVI_CTRL)
+
+// status holds any of XLAT_MODS, keycode must be below XLAT_KEYS
+#ifdef XLAT_COMPACT
+uint16_t xlat(byte status, byte keycode);
+#else
+extern const uint16_t xlat_table[XLAT_STATES * XLAT_KEYS] PROGMEM;
+
+static inline uint16_t xlat(byte status, byte keycode) {
+	return pgm_read_word(&xlat_table[(status >> 4) * XLAT_KEYS + keycode]);
+}
+#endif
+
+// The frame for keycode with the modifiers held (MOD_* bits): the keypad
+// sends edit keys with numlock off, shift, alpha lock and control pick the
+// table, and ALT adds TVI_FUNCT
+static inline uint16_t xlat_frame(byte modifier, byte keycode) {
+	byte status = 0;
+	uint16_t entry;
+
+	if (!(modifier & MOD_NLOCK) && keycode >= KEY_KP_0 && keycode <= KEY_KP_DOT)
+		keycode += NLOCK_OFFSET;
+	if (modifier & (MOD_LSHIFT|MOD_RSHIFT))
+		status |= TVI_SHIFT;
+	if (modifier & MOD_CLOCK)
+		status |= TVI_ALOCK;
+	if (modifier & (MOD_LCTRL|MOD_RCTRL))
+		status |= TVI_CTRL;
+	entry = xlat(status, keycode);
+	if (modifier & (MOD_LALT|MOD_RALT))
+		entry |= TVI_FUNCT << 8;
+	return entry;
+}
+
+// The frame a typist would send for each ASCII character, from the same
+// rules: the key for it, with shift and control as needed.  CR and LF are
+// the Return key, and tab, backspace and escape their own keys.
+extern const uint16_t xlat_ascii[128] PROGMEM;
+
+#endif
@@ -0,0 +1,146 @@
+/* tviq.cpp, queue of TVI frames waiting for the serial line
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Keystrokes are queued here as whole two byte frames and only handed to
+// Serial when its buffer has room for both bytes, so write() never blocks
+// the loop and the terminal never sees half a frame.  The UART interrupt
+// empties Serial's buffer and wakes loop(), which tops it up again from
+// here with tviq_pump().
+//
+// Repeats are what overrun a slow line.  A new frame that finds the queue
+// full makes room by dropping the oldest repeat waiting, and a repeat either
+// does the same (TVIQ_DROP_OLDEST) or is merged into the ones already there
+// (TVIQ_MERGE).  Only when every frame waiting is an ordinary keystroke does
+// loop() stop reading scan codes, so those wait in ps2rx.cpp's ring, and
+// once that's nearly full in the keyboard's own buffer, instead of being
+// lost.
+//
+// With TRACE_CAPTURE the frames go into the trace instead, see trace.h.
+// With STATS each frame is stamped so its time in here can be counted.
+
+#include "tviq.h"
+#include "trace.h"
+#include "stats.h"
+#include "termrx.h"
+
+byte tviq_highWater;
+unsigned int tviq_merges;
+unsigned int tviq_drops;
+
+void tviq_begin(TviQueue &q, HardwareSerial *port) {
+	q.port = port;
+	q.hold = TVIQ_OPEN;
+}
+
+// Take out the oldest repeat, returns false if none is waiting
+static bool dropOldestRepeat(TviQueue &q) {
+	byte i, j;
+
+	for (i=0; i<q.count; i++) {
+		if (q.frames[(q.head + i) % TVIQ_SIZE].repeat) {
+			for (j=i; j+1<q.count; j++)
+				q.frames[(q.head + j) % TVIQ_SIZE] = q.frames[(q.head + j + 1) % TVIQ_SIZE];
+			q.count--;
+			q.repeats--;
+			tviq_drops++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool tviq_put(TviQueue &q, byte status, byte code, bool repeat) {
+	if (q.hold == TVIQ_FLUSH) {
+		tviq_drops++;
+		return false;
+	}
+	if (q.count == TVIQ_SIZE) {
+		if (repeat && TVIQ_POLICY == TVIQ_MERGE) {
+			tviq_merges++;
+			return false;
+		}
+		if (!dropOldestRepeat(q)) {
+			tviq_drops++;
+			return false;
+		}
+	}
+	TviFrame &f = q.frames[(q.head + q.count) % TVIQ_SIZE];
+	f.status = status;
+	f.code = code;
+	f.repeat = repeat;
+#	ifdef STATS
+	f.queued = stats_waitStamp();
+#	endif
+	q.repeats += repeat;
+	if (++q.count > tviq_highWater)
+		tviq_highWater = q.count;
+	tviq_pump(q);
+	return true;
+}
+
+// Move as many whole frames into the port as it will take without
+// blocking, unless a stats reply, trace dump or capture log is going out,
+// or they're being held
+void tviq_pump(TviQueue &q) {
+	if (stats_sending() || trace_sending() || termrx_sending() || q.hold == TVIQ_HOLD)
+		return;
+#	ifdef TRACE_CAPTURE
+	while (q.count && trace_room()) {
+#	else
+	while (q.count && q.port->availableForWrite() >= 2) {
+		q.port->write(q.frames[q.head].status);
+		q.port->write(q.frames[q.head].code);
+#	endif
+		trace_put(TR_TVI, q.frames[q.head].status, q.frames[q.head].code);
+#		ifdef STATS
+		stats_time(ST_WAIT, (uint16_t)(stats_waitStamp() - q.frames[q.head].queued));
+#		endif
+		q.repeats -= q.frames[q.head].repeat;
+		q.head = (q.head + 1) % TVIQ_SIZE;
+		q.count--;
+	}
+}
+
+// Keep frames back, or throw them away, for a while; see converter.cpp
+void tviq_hold(TviQueue &q, byte how) {
+	if (how == TVIQ_FLUSH) {
+		tviq_drops += q.count;
+		q.count = 0;
+		q.repeats = 0;
+	}
+	q.hold = how;
+	tviq_pump(q);
+}
+
+// Full of frames that mustn't be dropped
+bool tviq_full(const TviQueue &q) {
+	return q.count == TVIQ_SIZE && !q.repeats;
+}
+
+byte tviq_count(const TviQueue &q) {
+	return q.count;
+}
+
+byte tviq_backlog(const TviQueue &q) {
+#	ifdef TRACE_CAPTURE
+	return q.count * 2;
+#	else
+	return q.count * 2 + HAL_SERIAL_TX - q.port->availableForWrite();
+#	endif
+}
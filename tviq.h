@@ -0,0 +1,69 @@
+/* tviq.h, queue of TVI frames waiting for the serial line
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TVIQ_H
+#define TVIQ_H
+
+#include "hal.h"
+#include "stats.h"
+
+#define TVIQ_SIZE	16	// Frames (status and code pairs) waiting to go out
+
+// What a repeat does when it finds the queue full
+#define TVIQ_MERGE		0	// Fold it into the repeats already waiting
+#define TVIQ_DROP_OLDEST	1	// Make room by dropping the oldest waiting repeat
+#define TVIQ_POLICY	TVIQ_DROP_OLDEST
+
+// What tviq_hold() does with frames until it's called with TVIQ_OPEN
+#define TVIQ_OPEN	0	// Nothing, they go out as usual
+#define TVIQ_HOLD	1	// They wait in the queue
+#define TVIQ_FLUSH	2	// Those waiting and those put are thrown away
+
+struct TviFrame {
+	byte status;
+	byte code;
+	byte repeat;
+#	ifdef STATS
+	uint16_t queued;		// stats_waitStamp() when put
+#	endif
+};
+
+// The frames waiting for one terminal
+struct TviQueue {
+	HardwareSerial *port;
+	TviFrame frames[TVIQ_SIZE];
+	byte head, count;
+	byte repeats;			// How many of them are repeats
+	byte hold;			// TVIQ_OPEN, or what tviq_hold() asked
+};
+
+void tviq_begin(TviQueue &q, HardwareSerial *port);
+bool tviq_put(TviQueue &q, byte status, byte code, bool repeat);
+void tviq_pump(TviQueue &q);
+void tviq_hold(TviQueue &q, byte how);
+bool tviq_full(const TviQueue &q);
+byte tviq_count(const TviQueue &q);
+byte tviq_backlog(const TviQueue &q);	// Bytes queued here and in its port
+
+// Over all the queues
+extern byte tviq_highWater;		// Most frames ever waiting at once
+extern unsigned int tviq_merges;	// Repeats folded into ones already queued
+extern unsigned int tviq_drops;		// Frames thrown away
+
+#endif
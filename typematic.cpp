@@ -0,0 +1,94 @@
+/* typematic.cpp, key repeat generated by the converter
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// The keyboard is told to repeat as slowly as it can and its repeats are
+// thrown away; instead the TVI frame of the last key pressed is sent again
+// on a timer for as long as that key stays down with the same modifiers.
+// Keys are the numbers keys.h uses.  A keyboard that repeats at all keeps
+// sending the make of the key, and typematic_poll() lets go of the key when
+// it stops, as a break lost on the way would otherwise repeat for ever.
+// The timer interrupt only counts, and each converter's loop() pass queues
+// its frame when the count passes the one it's waiting for.
+
+#include "typematic.h"
+
+#define TICKS(ms)	((ms) * 1000L / HAL_TICK_US)
+
+static volatile uint16_t ticks;
+
+static void tick(void) {
+	ticks++;
+}
+
+static uint16_t now(void) {
+	uint16_t t;
+
+	noInterrupts();
+	t = ticks;
+	interrupts();
+	return t;
+}
+
+void typematic_begin(void) {
+	hal_tickBegin(tick);
+}
+
+// A key was just pressed and its frame sent; key 0 (pause) doesn't repeat
+void typematic_start(Typematic &t, byte key, byte mods, byte status, byte code) {
+	t.key = key;
+	t.mods = mods;
+	t.status = status;
+	t.code = code;
+	t.heard = now();
+	t.next = t.heard + TICKS(TYPEMATIC_DELAY);
+}
+
+void typematic_heard(Typematic &t, byte key) {
+	if (key == t.key)
+		t.heard = now();
+}
+
+// Stop once the key is let go or the modifiers change
+void typematic_check(Typematic &t, const Keys &keys, byte mods) {
+	if (t.key && (!keys_isDown(keys, t.key) || mods != t.mods))
+		t.key = 0;
+}
+
+// After a byte from the keyboard went missing
+void typematic_stop(Typematic &t) {
+	t.key = 0;
+}
+
+// Repeats that fell due while loop() was busy aren't worth catching up on,
+// the next one is still due when it would have been.  watch if the keyboard
+// sends its own repeats, which set 3 as we set it up doesn't.
+void typematic_poll(Typematic &t, Keys &keys, bool watch, TviQueue &q) {
+	uint16_t n = now();
+
+	if (t.key && watch && (uint16_t)(n - t.heard) > TICKS(TYPEMATIC_WATCHDOG)) {
+		keys_release(keys, t.key);
+		t.key = 0;
+	}
+	if (!t.key || (int16_t)(n - t.next) < 0)
+		return;
+	do
+		t.next += TICKS(TYPEMATIC_MS);
+	while ((int16_t)(n - t.next) >= 0);
+	tviq_put(q, t.status, t.code, true);
+}
@@ -0,0 +1,58 @@
+/* typematic.h, key repeat generated by the converter
+ *
+ * Copyright (C) 2018 Patrick Finnegan <pat@vax11.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TYPEMATIC_H
+#define TYPEMATIC_H
+
+#include "hal.h"
+#include "PS2_TVI.h"
+#include "keys.h"
+#include "tviq.h"
+
+#define TYPEMATIC_DELAY	500	// ms a key is held before it starts repeating
+#define TYPEMATIC_CPS	20	// Repeats per second, if the line can take them
+
+// Repeats never use more than half the line; a frame is 2 bytes of 10 bits
+#define TYPEMATIC_LINE_MS	(2 * 2 * 10 * 1000L / HOSTBAUD + 1)
+#define TYPEMATIC_MS	(1000 / TYPEMATIC_CPS > TYPEMATIC_LINE_MS ? \
+				1000 / TYPEMATIC_CPS : TYPEMATIC_LINE_MS)
+
+// What we ask the keyboard for instead, so it hardly ever repeats itself:
+// 1s delay, 2 per second
+#define TYPEMATIC_KBD	0x7F
+// Its repeats still come, and when they don't for half as long again as
+// that delay, the break was lost and the key is taken as let go
+#define TYPEMATIC_WATCHDOG	1500
+
+// The key one converter is repeating
+struct Typematic {
+	byte key, mods;			// What's held down, 0 if nothing repeats
+	byte status, code;		// The frame it sends
+	uint16_t next;			// typematic_ticks when it's next due
+	uint16_t heard;			// and when the keyboard last sent it
+};
+
+void typematic_begin(void);
+void typematic_start(Typematic &t, byte key, byte mods, byte status, byte code);
+void typematic_heard(Typematic &t, byte key);	// The keyboard's own repeat
+void typematic_check(Typematic &t, const Keys &keys, byte mods);
+void typematic_stop(Typematic &t);
+void typematic_poll(Typematic &t, Keys &keys, bool watch, TviQueue &q);
+
+#endif